@@ -0,0 +1,221 @@
+// heap_bench.c - Host-side kmalloc/kfree benchmark
+// Replays allocation traces modelled on kernel workloads against the heap
+// in src/kernel/memory.c and reports throughput, latency percentiles and
+// fragmentation. Built and run with 'make bench'.
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#include <process.h>    // sizeof(process_t) for the PCB trace
+
+#define BENCH_HEAP_SIZE     (16 * 1024 * 1024)
+#define BENCH_MAX_LIVE      4096
+#define BENCH_MAX_SAMPLES   (1 << 20)
+
+typedef struct {
+    const char* name;
+    uint32_t ops;
+    void (*run)(uint32_t ops);
+} bench_trace_t;
+
+// Live allocations of the running trace
+static void* live[BENCH_MAX_LIVE];
+static size_t live_size[BENCH_MAX_LIVE];
+
+// Per-operation latencies (ns) of the running trace
+static uint32_t samples[BENCH_MAX_SAMPLES];
+static uint32_t sample_count;
+static uint32_t failed_allocs;
+
+static uint32_t rng_state = 0x2545F491;
+
+static uint32_t rng_next(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+static uint32_t rng_range(uint32_t low, uint32_t high) {
+    return low + rng_next() % (high - low + 1);
+}
+
+static inline uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void record(uint64_t start) {
+    uint64_t elapsed = now_ns() - start;
+    if (sample_count < BENCH_MAX_SAMPLES) {
+        samples[sample_count++] = elapsed > UINT32_MAX ? UINT32_MAX : (uint32_t)elapsed;
+    }
+}
+
+static void timed_alloc(int slot, size_t size) {
+    uint64_t start = now_ns();
+    void* ptr = kmalloc(size);
+    record(start);
+
+    if (!ptr) {
+        failed_allocs++;
+        return;
+    }
+    // Touch the block so traces pay for cache misses like the kernel would
+    ((volatile uint8_t*)ptr)[0] = (uint8_t)slot;
+    live[slot] = ptr;
+    live_size[slot] = size;
+}
+
+static void timed_free(int slot) {
+    uint64_t start = now_ns();
+    kfree(live[slot]);
+    record(start);
+    live[slot] = NULL;
+}
+
+static void free_all(void) {
+    for (int i = 0; i < BENCH_MAX_LIVE; i++) {
+        if (live[i]) {
+            kfree(live[i]);
+            live[i] = NULL;
+        }
+    }
+}
+
+// PCB churn: processes created and destroyed around a steady population
+static void trace_pcb_churn(uint32_t ops) {
+    const int population = 64;
+    for (uint32_t i = 0; i < ops; i++) {
+        int slot = (int)(rng_next() % population);
+        if (live[slot]) {
+            timed_free(slot);
+        } else {
+            timed_alloc(slot, sizeof(process_t));
+        }
+    }
+}
+
+// Page tables: address spaces built up table by table, then torn down
+static void trace_page_tables(uint32_t ops) {
+    uint32_t done = 0;
+    while (done < ops) {
+        int tables = (int)rng_range(4, 64);
+        for (int i = 0; i < tables && done < ops; i++, done++) {
+            timed_alloc(i, PAGE_SIZE);
+        }
+        for (int i = 0; i < tables && done < ops; i++, done++) {
+            if (live[i]) {
+                timed_free(i);
+            }
+        }
+    }
+}
+
+// Mixed sizes: mostly small objects, some medium buffers and a tail of
+// large ones, with random lifetimes over a large working set
+static size_t mixed_size(void) {
+    uint32_t pick = rng_next() % 100;
+    if (pick < 70) {
+        return rng_range(8, 256);
+    } else if (pick < 90) {
+        return rng_range(257, 2048);
+    }
+    return rng_range(2049, 16384);
+}
+
+static void trace_mixed(uint32_t ops) {
+    const int working_set = 2048;
+    for (uint32_t i = 0; i < ops; i++) {
+        int slot = (int)(rng_next() % working_set);
+        if (live[slot]) {
+            timed_free(slot);
+        } else {
+            timed_alloc(slot, mixed_size());
+        }
+    }
+}
+
+static int compare_u32(const void* a, const void* b) {
+    uint32_t x = *(const uint32_t*)a;
+    uint32_t y = *(const uint32_t*)b;
+    return (x > y) - (x < y);
+}
+
+static uint32_t percentile(uint32_t pct) {
+    if (sample_count == 0) {
+        return 0;
+    }
+    uint32_t index = (uint32_t)(((uint64_t)sample_count * pct) / 100);
+    return samples[index < sample_count ? index : sample_count - 1];
+}
+
+static void run_trace(const bench_trace_t* trace) {
+    memset(live, 0, sizeof(live));
+    sample_count = 0;
+    failed_allocs = 0;
+    rng_state = 0x2545F491;
+
+    uint64_t start = now_ns();
+    trace->run(trace->ops);
+    uint64_t elapsed = now_ns() - start;
+
+    // Fragmentation is measured with the trace's live set still allocated:
+    // the share of free heap memory not usable for one large allocation
+    memory_stats_t stats;
+    memory_get_stats(&stats);
+    uint32_t frag = stats.free_memory
+        ? 100 - (uint32_t)(((uint64_t)stats.largest_free_block * 100) / stats.free_memory)
+        : 0;
+
+    qsort(samples, sample_count, sizeof(samples[0]), compare_u32);
+    double seconds = (double)elapsed / 1e9;
+
+    printf("%-12s %9u %12.0f %7u %7u %7u %9u KB %5u%%",
+           trace->name, trace->ops, trace->ops / seconds,
+           percentile(50), percentile(99), samples[sample_count - 1],
+           stats.used_memory / 1024, frag);
+    if (failed_allocs) {
+        printf("  (%u failed)", failed_allocs);
+    }
+    printf("\n");
+
+    free_all();
+}
+
+int main(int argc, char** argv) {
+    uint32_t scale = argc > 1 ? (uint32_t)strtoul(argv[1], NULL, 10) : 1;
+    if (scale == 0) {
+        scale = 1;
+    }
+
+    // memory_init() takes a 32-bit base, so the heap must live below 4GB
+    void* heap = mmap(NULL, BENCH_HEAP_SIZE, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT, -1, 0);
+    if (heap == MAP_FAILED || (uintptr_t)heap + BENCH_HEAP_SIZE > UINT32_MAX) {
+        fprintf(stderr, "heap_bench: cannot map heap below 4GB\n");
+        return 1;
+    }
+    memory_init((uint32_t)(uintptr_t)heap, BENCH_HEAP_SIZE);
+
+    const bench_trace_t traces[] = {
+        { "pcb-churn",   200000 * scale, trace_pcb_churn },
+        { "page-tables", 200000 * scale, trace_page_tables },
+        { "mixed",       400000 * scale, trace_mixed },
+    };
+
+    printf("Heap benchmark (%u MB heap, latencies in ns)\n\n",
+           BENCH_HEAP_SIZE / (1024 * 1024));
+    printf("%-12s %9s %12s %7s %7s %7s %12s %6s\n",
+           "trace", "ops", "ops/sec", "p50", "p99", "max", "live", "frag");
+    for (size_t i = 0; i < sizeof(traces) / sizeof(traces[0]); i++) {
+        run_trace(&traces[i]);
+    }
+
+    return 0;
+}
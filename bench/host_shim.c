@@ -0,0 +1,43 @@
+// host_shim.c - Host stand-ins for the kernel services memory.c uses
+// Lets the heap allocator be linked into an ordinary user-space program.
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// No SSE string paths on the host: they disable interrupts
+uint32_t cpu_features = 0;
+
+// Kernel log output is discarded unless AETHER_BENCH_VERBOSE is defined
+int printk(const char* format, ...) {
+#ifdef AETHER_BENCH_VERBOSE
+    va_list args;
+    va_start(args, format);
+    int written = vprintf(format, args);
+    va_end(args);
+    return written;
+#else
+    (void)format;
+    return 0;
+#endif
+}
+
+void printk_info(const char* format, ...) {
+    (void)format;
+}
+
+void printk_warn(const char* format, ...) {
+    (void)format;
+}
+
+void printk_error(const char* format, ...) {
+    (void)format;
+}
+
+// Single-threaded on the host: nothing to disable
+uint32_t cpu_irq_save(void) {
+    return 0;
+}
+
+void cpu_irq_restore(uint32_t eflags) {
+    (void)eflags;
+}
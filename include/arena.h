@@ -0,0 +1,46 @@
+// arena.h - Bump-pointer arenas for short-lived kernel allocations
+// An arena hands out memory from page-sized chunks by advancing a pointer.
+// Individual allocations are never freed; arena_reset() releases everything
+// allocated since creation at once, keeping the first chunk for reuse.
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define ARENA_ALIGN         8       // Alignment of every arena allocation
+
+// Chunk header; the chunk's data follows it in the same frames
+typedef struct arena_chunk {
+    struct arena_chunk* prev;   // Previously filled chunk (NULL for the first)
+    uint32_t order;             // Chunk spans 2^order frames
+    uint32_t used;              // Bytes in use, including this header
+    uint32_t size;              // Total bytes in the chunk
+} arena_chunk_t;
+
+typedef struct {
+    arena_chunk_t* current;     // Chunk allocations are served from
+    arena_chunk_t* first;       // Chunk holding the arena itself
+
+    // Statistics
+    uint32_t allocated;         // Bytes handed out since the last reset
+    uint32_t peak;              // Largest 'allocated' seen
+    uint32_t chunks;            // Chunks currently held
+    uint32_t resets;
+} arena_t;
+
+// Create an arena. The arena_t lives in its own first chunk, so creating
+// one costs a single frame and no heap memory.
+arena_t* arena_create(void);
+void arena_destroy(arena_t* arena);
+
+// Allocate 'size' bytes aligned to ARENA_ALIGN (NULL when out of memory)
+void* arena_alloc(arena_t* arena, size_t size);
+void* arena_calloc(arena_t* arena, size_t size);
+
+// Release every allocation at once
+void arena_reset(arena_t* arena);
+
+void arena_print_stats(const arena_t* arena);
+
+#endif // ARENA_H
@@ -11,6 +11,10 @@ extern uint32_t read_esp(void);
 extern uint32_t read_ebp(void);
 extern uint32_t read_eip(void);
 
+// Context switches that loaded a new CR3 / stayed in the same address space
+extern uint32_t context_cr3_reloads;
+extern uint32_t context_cr3_skips;
+
 // High-level context management
 void context_init(void);
 void switch_to_process(process_t* new_process);
@@ -0,0 +1,68 @@
+// cpu.h - CPU feature detection and control register setup
+#ifndef CPU_H
+#define CPU_H
+
+#include <stdint.h>
+
+// Kernel-visible CPU features (bits of cpu_features)
+#define CPU_FEATURE_CPUID       0x01    // CPUID instruction available
+#define CPU_FEATURE_PSE         0x02    // 4MB pages
+#define CPU_FEATURE_PGE         0x04    // Global pages
+#define CPU_FEATURE_FXSR        0x08    // FXSAVE/FXRSTOR
+#define CPU_FEATURE_SSE         0x10
+#define CPU_FEATURE_SSE2        0x20
+#define CPU_FEATURE_SSE_ENABLED 0x40    // CR0/CR4 set up for SSE instructions
+
+// CPUID leaf 1 EDX bits
+#define CPUID_EDX_PSE           (1 << 3)
+#define CPUID_EDX_PGE           (1 << 13)
+#define CPUID_EDX_FXSR          (1 << 24)
+#define CPUID_EDX_SSE           (1 << 25)
+#define CPUID_EDX_SSE2          (1 << 26)
+
+// Control register bits
+#define CR0_MP                  (1 << 1)
+#define CR0_EM                  (1 << 2)
+#define CR0_WP                  (1 << 16)
+#define CR4_PSE                 (1 << 4)
+#define CR4_PGE                 (1 << 7)
+#define CR4_OSFXSR              (1 << 9)
+#define CR4_OSXMMEXCPT          (1 << 10)
+
+// Detected features (0 until cpu_init runs)
+extern uint32_t cpu_features;
+
+// Detect CPU features and enable SSE when present
+void cpu_init(void);
+
+// Disable interrupts, returning the previous EFLAGS for cpu_irq_restore().
+// Out of line so that host builds of kernel code (the heap benchmark) can
+// replace them.
+uint32_t cpu_irq_save(void);
+void cpu_irq_restore(uint32_t eflags);
+
+static inline int cpu_has(uint32_t feature) {
+    return (cpu_features & feature) != 0;
+}
+
+static inline uint32_t cpu_read_cr0(void) {
+    uint32_t value;
+    __asm__ volatile("mov %%cr0, %0" : "=r"(value));
+    return value;
+}
+
+static inline void cpu_write_cr0(uint32_t value) {
+    __asm__ volatile("mov %0, %%cr0" : : "r"(value) : "memory");
+}
+
+static inline uint32_t cpu_read_cr4(void) {
+    uint32_t value;
+    __asm__ volatile("mov %%cr4, %0" : "=r"(value));
+    return value;
+}
+
+static inline void cpu_write_cr4(uint32_t value) {
+    __asm__ volatile("mov %0, %%cr4" : : "r"(value) : "memory");
+}
+
+#endif // CPU_H
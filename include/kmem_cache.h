@@ -0,0 +1,52 @@
+// kmem_cache.h - Typed object caches
+// A cache hands out fixed-size objects that are constructed once, when their
+// memory is first obtained. Freed objects are kept in their constructed
+// state and recycled by the next allocation without touching the heap.
+#ifndef KMEM_CACHE_H
+#define KMEM_CACHE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Cache flags
+#define KMEM_CACHE_FRAMES       0x01    // One physical frame per object (size <= PAGE_SIZE)
+
+// Free objects kept per cache; further frees release memory to the backend
+#define KMEM_CACHE_MAX_FREE     64
+
+// Constructor: put a freshly obtained object into its initial state
+typedef void (*kmem_ctor_t)(void* object, size_t size);
+
+typedef struct kmem_cache {
+    const char* name;
+    uint32_t object_size;
+    uint32_t flags;
+    kmem_ctor_t ctor;
+    
+    void* free_objects[KMEM_CACHE_MAX_FREE];    // Constructed, unused objects
+    uint32_t free_count;
+    
+    // Statistics
+    uint32_t objects_in_use;
+    uint32_t allocations;
+    uint32_t recycled;          // Allocations served from free_objects
+    
+    struct kmem_cache* next;    // All caches, for reporting
+} kmem_cache_t;
+
+// Create a cache. Objects must be returned to kmem_cache_free in the state
+// the constructor leaves them in (e.g. zeroed).
+kmem_cache_t* kmem_cache_create(const char* name, size_t object_size,
+                                kmem_ctor_t ctor, uint32_t flags);
+void* kmem_cache_alloc(kmem_cache_t* cache);
+void kmem_cache_free(kmem_cache_t* cache, void* object);
+
+// Release every cached free object back to its backend
+void kmem_cache_shrink(kmem_cache_t* cache);
+
+// Constructor that zero-fills the object
+void kmem_ctor_zero(void* object, size_t size);
+
+void kmem_cache_print_stats(void);
+
+#endif // KMEM_CACHE_H
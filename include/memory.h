@@ -5,19 +5,56 @@
 #include <stddef.h>
 
 // Memory layout constants
-#define KERNEL_START        0x100000    // 1MB - where kernel is loaded
-#define KERNEL_HEAP_START   0x200000    // 2MB - start of kernel heap
-#define KERNEL_HEAP_SIZE    0x400000    // 4MB - kernel heap size
+#define KERNEL_START        0x100000    // 1MB - physical address the kernel is loaded at
+#define KERNEL_HEAP_START   0x200000    // 2MB - lowest heap start (placed after the kernel image)
+#define KERNEL_HEAP_SIZE    0x400000    // 4MB - minimum kernel heap size
+#define KERNEL_HEAP_MAX     0x4000000   // 64MB - heap size cap on large machines
+#define KERNEL_HEAP_RAM_DIV 16          // Heap gets 1/16 of usable RAM within those bounds
 #define PAGE_SIZE           0x1000      // 4KB pages
 
-// Memory block header for simple heap allocator
+// The kernel is linked at KERNEL_VIRTUAL_BASE, where all RAM is mapped in
+// every address space (physical address p is at KERNEL_VIRTUAL_BASE + p).
+// Everything below it belongs to user space.
+#define KERNEL_VIRTUAL_BASE 0xC0000000
+#define KERNEL_BOOT_MAP_END 0x800000    // RAM mapped by the boot page tables (kernel_entry.asm)
+
+static inline void* phys_to_virt(uint32_t physical_addr) {
+    return (void*)(uintptr_t)(physical_addr + KERNEL_VIRTUAL_BASE);
+}
+
+static inline uint32_t virt_to_phys(const void* virtual_addr) {
+    return (uint32_t)(uintptr_t)virtual_addr - KERNEL_VIRTUAL_BASE;
+}
+
+// Kernel stacks are mapped on demand into their own virtual region, each
+// below an unmapped guard page (one page table covers the whole region)
+#define KERNEL_STACK_REGION     0xF0000000
+#define KERNEL_STACK_REGION_END 0xF0400000
+
+// Slab allocator size classes (16, 32, ... 2048 bytes)
+#define SLAB_MIN_SIZE       16
+#define SLAB_MAX_SIZE       2048
+#define SLAB_NUM_CLASSES    8
+
+// Heap block header (boundary-tag layout)
+// Only prev_phys and size precede the payload of a used block; the free-list
+// links overlay the payload while the block is free.
 typedef struct memory_block {
-    size_t size;
-    int is_free;
-    struct memory_block* next;
-    struct memory_block* prev;
+    struct memory_block* prev_phys;     // Physically preceding block
+    size_t size;                        // Payload size | BLOCK_* flag bits
+    struct memory_block* next_free;     // Next block in the same free list
+    struct memory_block* prev_free;     // Previous block in the same free list
 } memory_block_t;
 
+// Per size-class slab occupancy
+typedef struct {
+    uint32_t object_size;       // Bytes per object
+    uint32_t slab_size;         // Bytes per slab (power of two)
+    uint32_t slabs;             // Slabs currently owned by this class
+    uint32_t objects_in_use;    // Live objects
+    uint32_t objects_total;     // Capacity across all slabs
+} slab_class_stats_t;
+
 // Memory statistics
 typedef struct {
     uint32_t total_memory;
@@ -25,10 +62,12 @@ typedef struct {
     uint32_t free_memory;
     uint32_t allocated_blocks;
     uint32_t free_blocks;
+    uint32_t largest_free_block;    // Largest single block heap allocation possible
+    slab_class_stats_t slab_classes[SLAB_NUM_CLASSES];
 } memory_stats_t;
 
 // Function prototypes
-void memory_init(void);
+void memory_init(uint32_t heap_base, uint32_t heap_size);
 void* kmalloc(size_t size);
 void kfree(void* ptr);
 void* krealloc(void* ptr, size_t new_size);
@@ -38,6 +77,13 @@ void* kcalloc(size_t num, size_t size);
 void memory_get_stats(memory_stats_t* stats);
 void memory_print_stats(void);
 void memory_dump_heap(void);
+uint32_t memory_get_fragmentation(void);
+void memory_print_fragmentation(void);
+
+// Allocation-site profiling (off by default)
+void memory_profile_enable(int enable);
+int memory_profile_enabled(void);
+void memory_print_profile(void);
 
 // Physical memory management (basic)
 uint32_t memory_get_total(void);
@@ -0,0 +1,76 @@
+// multiboot.h - Multiboot v1 boot information
+#ifndef MULTIBOOT_H
+#define MULTIBOOT_H
+
+#include <stdint.h>
+
+// Value passed in EAX by a Multiboot-compliant bootloader
+#define MULTIBOOT_BOOTLOADER_MAGIC  0x2BADB002
+
+// multiboot_info_t.flags bits
+#define MULTIBOOT_INFO_MEMORY       0x001   // mem_lower/mem_upper valid
+#define MULTIBOOT_INFO_CMDLINE      0x004   // cmdline valid
+#define MULTIBOOT_INFO_MEM_MAP      0x040   // mmap_addr/mmap_length valid
+
+// Memory map entry types
+#define MULTIBOOT_MEMORY_AVAILABLE  1
+
+// Highest physical address the kernel will manage (768MB): all of it is
+// mapped between KERNEL_VIRTUAL_BASE and the kernel stack region
+#define BOOT_MEMORY_LIMIT           0x30000000
+
+// Maximum number of usable regions kept from the memory map
+#define BOOT_MAX_REGIONS            32
+
+// Boot information structure (filled in by the bootloader)
+typedef struct {
+    uint32_t flags;
+    uint32_t mem_lower;         // KB of memory below 1MB
+    uint32_t mem_upper;         // KB of memory above 1MB
+    uint32_t boot_device;
+    uint32_t cmdline;
+    uint32_t mods_count;
+    uint32_t mods_addr;
+    uint32_t syms[4];
+    uint32_t mmap_length;       // Size of the memory map buffer in bytes
+    uint32_t mmap_addr;         // Physical address of the memory map
+    uint32_t drives_length;
+    uint32_t drives_addr;
+    uint32_t config_table;
+    uint32_t boot_loader_name;
+    uint32_t apm_table;
+} __attribute__((packed)) multiboot_info_t;
+
+// Memory map entry ('size' does not include the size field itself)
+typedef struct {
+    uint32_t size;
+    uint64_t addr;
+    uint64_t len;
+    uint32_t type;
+} __attribute__((packed)) multiboot_mmap_entry_t;
+
+// Usable RAM region (clamped to BOOT_MEMORY_LIMIT)
+typedef struct {
+    uint32_t base;
+    uint32_t length;
+} boot_region_t;
+
+// Summary of usable memory, copied out of the boot information
+typedef struct {
+    uint32_t region_count;
+    boot_region_t regions[BOOT_MAX_REGIONS];
+    uint32_t memory_end;        // End of the highest usable region
+    uint32_t usable_memory;     // Total bytes of usable RAM
+} boot_memory_map_t;
+
+// Parse the boot information into a memory map. Falls back to
+// mem_upper, then to PMM_DEFAULT_MEMORY_END, when no map is provided.
+void multiboot_parse(uint32_t magic, const multiboot_info_t* info,
+                     boot_memory_map_t* map);
+
+// Whether the kernel command line contains 'option' as a whole
+// space-separated word (e.g. "sched=fair")
+int multiboot_has_option(uint32_t magic, const multiboot_info_t* info,
+                         const char* option);
+
+#endif // MULTIBOOT_H
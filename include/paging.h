@@ -21,6 +21,47 @@
 #define PAGE_DIRTY          0x040   // Page has been written to
 #define PAGE_SIZE_4MB       0x080   // 4MB pages (only in page directory)
 #define PAGE_GLOBAL         0x100   // Global page (TLB)
+#define PAGE_COW            0x200   // Shared read-only, copy on write (OS bit)
+
+// 4MB pages mapped directly by a page directory entry (requires CR4.PSE)
+#define PAGE_SIZE_LARGE     0x400000
+#define PAGE_LARGE_MASK     0xFFC00000  // Frame address bits of a 4MB PDE
+
+// Page directory entries from here up map the kernel half. They are the
+// same in every address space; everything below is private user memory.
+#define PAGE_KERNEL_FIRST_PDE   768     // KERNEL_VIRTUAL_BASE >> 22
+
+// Ranges longer than this are invalidated with one full TLB flush instead
+// of an invlpg per page
+#define PAGING_INVLPG_MAX   32
+
+// Entries of the translation cache used by paging_get_physical_address()
+#define PAGING_XLATE_ENTRIES 64
+
+// The last page directory slot maps the directory itself, so the page
+// tables of the loaded address space are visible at fixed addresses
+#define PAGE_RECURSIVE_SLOT 1023
+#define PAGE_TABLES_VIRT    0xFFC00000  // Page table for va at + (va >> 22) * 4KB
+#define PAGE_DIRECTORY_VIRT 0xFFFFF000  // The directory itself
+
+// Page fault error code bits
+#define PAGE_FAULT_PRESENT  (1 << 0)    // Page was present (protection violation)
+#define PAGE_FAULT_WRITE    (1 << 1)    // Write operation caused fault
+#define PAGE_FAULT_USER     (1 << 2)    // Fault occurred in user mode
+#define PAGE_FAULT_RESERVED (1 << 3)    // Reserved bit was set
+#define PAGE_FAULT_FETCH    (1 << 4)    // Instruction fetch caused fault
+
+// Software counters for the paging paths
+typedef struct {
+    uint32_t walks;             // Page table walks done by the kernel
+    uint32_t xlate_hits;        // Lookups answered by the translation cache
+    uint32_t xlate_misses;
+    uint32_t faults;            // Page faults taken
+    uint32_t faults_resolved;   // ... resolved by demand paging or COW
+    uint32_t invlpg;            // Single-page TLB invalidations
+    uint32_t tlb_flushes;       // Full TLB flushes
+    uint32_t cr3_loads;         // CR3 writes by the paging code
+} paging_stats_t;
 
 // Page directory entry (PDE) - points to a page table
 typedef uint32_t page_directory_entry_t;
@@ -51,16 +92,29 @@ typedef struct {
     uint32_t frame      : 20;  // Physical frame number
 } physical_address_t;
 
-// Paging initialization
-void paging_init(void);
+// Paging initialization: the boot code runs with a temporary mapping of
+// low memory. paging_init() maps all RAM below memory_end into the kernel
+// half and switches to the kernel directory; page tables it needs are
+// placed after the kernel image. Returns the physical end of those tables.
+uint32_t paging_init(uint32_t memory_end);
 
-// Enable/disable paging
+// Finish setup once the heap works: page table caches, CR0.WP and global
+// pages
 void paging_enable(void);
-void paging_disable(void);
+
+// Paging state
+int paging_is_enabled(void);
+int paging_has_large_pages(void);
 
 // Page directory management
+page_directory_t* paging_get_kernel_directory(void);
 page_directory_t* paging_create_directory(void);
 void paging_destroy_directory(page_directory_t* dir);
+
+// Copy an address space for fork(). User pages are shared, not copied:
+// writable ones become read-only PAGE_COW in both directories and every
+// shared frame gains a reference.
+page_directory_t* paging_clone_directory(page_directory_t* src);
 void paging_switch_directory(page_directory_t* dir);
 page_directory_t* paging_get_current_directory(void);
 
@@ -68,14 +122,35 @@ page_directory_t* paging_get_current_directory(void);
 void paging_map_page(page_directory_t* dir, uint32_t virtual_addr, 
                      uint32_t physical_addr, uint32_t flags);
 void paging_unmap_page(page_directory_t* dir, uint32_t virtual_addr);
+
+// Map [virtual_addr, virtual_addr + size) to consecutive frames from
+// physical_addr. Each page table is looked up once per run of entries.
+// Returns 0, or -1 if a page table could not be allocated.
+int paging_map_range(page_directory_t* dir, uint32_t virtual_addr,
+                     uint32_t physical_addr, uint32_t size, uint32_t flags);
+
+// Unmap every present page in the range, passing its frame to release
+// (if not NULL). The TLB is invalidated once for the whole range: page by
+// page up to PAGING_INVLPG_MAX pages, with a full flush beyond that.
+// Returns the number of pages unmapped.
+uint32_t paging_unmap_range(page_directory_t* dir, uint32_t virtual_addr, uint32_t size,
+                            void (*release)(uint32_t frame));
 uint32_t paging_get_physical_address(page_directory_t* dir, uint32_t virtual_addr);
 
-// Identity mapping (virtual = physical)
-void paging_identity_map(page_directory_t* dir, uint32_t start, 
-                         uint32_t end, uint32_t flags);
+// Entry mapping a 4KB page (NULL if no page table covers it)
+page_table_entry_t* paging_get_pte(page_directory_t* dir, uint32_t virtual_addr);
+
+// Drop cached translations of a page whose entry was changed through
+// paging_get_pte()
+void paging_invalidate_page(page_directory_t* dir, uint32_t virtual_addr);
+
+// Statistics ('paging stats')
+void paging_get_stats(paging_stats_t* stats);
+void paging_print_stats(void);
 
-// Page fault handler
-void page_fault_handler(void);
+// Page fault handler: returns 1 if the fault was resolved and the faulting
+// instruction can be restarted, 0 if it is fatal
+int page_fault_handler(uint32_t faulting_address, uint32_t error_code);
 
 // Helper functions
 static inline uint32_t paging_directory_index(uint32_t virtual_addr) {
@@ -90,6 +165,15 @@ static inline uint32_t paging_page_offset(uint32_t virtual_addr) {
     return virtual_addr & 0xFFF;
 }
 
+// Entries of the loaded address space, through the recursive slot
+static inline page_directory_entry_t* paging_recursive_pde(uint32_t virtual_addr) {
+    return (page_directory_entry_t*)PAGE_DIRECTORY_VIRT + paging_directory_index(virtual_addr);
+}
+
+static inline page_table_t* paging_recursive_table(uint32_t virtual_addr) {
+    return (page_table_t*)(PAGE_TABLES_VIRT + paging_directory_index(virtual_addr) * PAGE_SIZE);
+}
+
 // Get physical frame number from address
 static inline uint32_t paging_frame_number(uint32_t physical_addr) {
     return physical_addr >> 12;
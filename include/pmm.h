@@ -0,0 +1,83 @@
+// pmm.h - Physical Memory Manager (page frame allocator)
+#ifndef PMM_H
+#define PMM_H
+
+#include <stdint.h>
+#include <memory.h>  // For PAGE_SIZE definition
+
+// Largest run handed out by the buddy allocator: 2^10 frames = 4MB
+#define PMM_MAX_ORDER           10
+
+// Memory assumed present until the multiboot memory map is parsed
+#define PMM_DEFAULT_MEMORY_END  0x2000000   // 32MB
+
+// Frames kept zeroed ahead of time. The idle loop refills the pool, so page
+// faults and page table allocation do not pay for clearing a frame.
+#define PMM_ZERO_POOL_SIZE      64
+#define PMM_ZERO_POOL_BATCH     4       // Frames zeroed per idle pass
+
+// Frame flags
+#define PMM_FRAME_FREE          0x01    // Frame heads a free buddy block
+#define PMM_FRAME_USABLE        0x02    // Frame is RAM managed by the allocator
+
+// Per-frame bookkeeping (one entry per 4KB frame)
+typedef struct {
+    uint32_t next;              // Next free block of the same order (frame index)
+    uint32_t prev;              // Previous free block of the same order
+    uint16_t refcount;          // Mappings sharing this frame
+    uint8_t order;              // Order of the free block this frame heads
+    uint8_t flags;              // PMM_FRAME_* flags
+} pmm_frame_t;
+
+// Physical memory statistics
+typedef struct {
+    uint32_t total_frames;      // Usable frames managed by the allocator
+    uint32_t free_frames;       // Frames currently free
+    uint32_t free_blocks[PMM_MAX_ORDER + 1];    // Free blocks per order
+    uint32_t zero_pool_frames;  // Pre-zeroed frames waiting in the pool
+    uint32_t zero_pool_hits;    // Zeroed allocations served from the pool
+    uint32_t zero_pool_misses;  // ... that had to clear a frame on the spot
+} pmm_stats_t;
+
+// Initialization: track frames below memory_end, storing the frame table at
+// metadata_base. All frames start out unusable until added as regions.
+void pmm_init(uint32_t memory_end, uint32_t metadata_base);
+uint32_t pmm_metadata_size(uint32_t memory_end);
+void pmm_add_region(uint32_t base, uint32_t length);
+void pmm_reserve_region(uint32_t base, uint32_t length);
+
+// Frame allocation (returns physical address, 0 on failure)
+uint32_t pmm_alloc_frame(void);
+uint32_t pmm_alloc_frames(uint32_t order);
+void pmm_free_frame(uint32_t addr);
+void pmm_free_frames(uint32_t addr, uint32_t order);
+
+// Allocate a frame filled with zeroes, from the pool when possible
+uint32_t pmm_alloc_zeroed_frame(void);
+
+// Zero up to max_frames frames into the pool (called while idle). Returns
+// the number of frames added; 0 once the pool is full.
+uint32_t pmm_zero_pool_refill(uint32_t max_frames);
+
+// Reference counts for frames mapped into several address spaces. A frame
+// starts with no references; dropping the last one frees it.
+void pmm_frame_ref(uint32_t addr);
+void pmm_frame_unref(uint32_t addr);
+uint32_t pmm_frame_refcount(uint32_t addr);
+
+// Information and debugging
+uint32_t pmm_get_memory_end(void);
+uint32_t pmm_get_free_memory(void);
+void pmm_get_stats(pmm_stats_t* stats);
+void pmm_print_stats(void);
+
+// Convert between physical addresses and frame numbers
+static inline uint32_t pmm_frame_index(uint32_t addr) {
+    return addr / PAGE_SIZE;
+}
+
+static inline uint32_t pmm_frame_address(uint32_t index) {
+    return index * PAGE_SIZE;
+}
+
+#endif // PMM_H
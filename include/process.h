@@ -4,10 +4,16 @@
 
 #include <stdint.h>
 #include <paging.h>
+#include <arena.h>
+#include <rbtree.h>
+#include <timer.h>
+
+struct vma;
 
 // Maximum number of processes
 #define MAX_PROCESSES       256
 #define KERNEL_STACK_SIZE   4096    // 4KB kernel stack per process
+#define KERNEL_STACK_SLOT   (KERNEL_STACK_SIZE + PAGE_SIZE) // Guard page + stack
 #define USER_STACK_SIZE     4096    // 4KB user stack per process
 
 // Process states
@@ -71,7 +77,9 @@ typedef struct process {
     page_directory_t* page_directory;   // Virtual address space
     uint32_t kernel_stack;          // Kernel stack pointer
     uint32_t user_stack;            // User stack pointer
+    struct vma* vmas;               // Reserved user memory areas, by address
     uint8_t is_kernel;              // 1 = kernel mode, 0 = user mode
+    arena_t* arena;                 // Scratch allocations (NULL until first use)
     
     // Parent/child relationships
     struct process* parent;         // Parent process
@@ -81,6 +89,9 @@ typedef struct process {
     // Scheduling
     struct process* next;           // Next process in queue
     struct process* prev;           // Previous process in queue
+    rb_node_t run_node;             // Position in the fair run queue
+    uint64_t vruntime;              // Weighted CPU time (fair policy)
+    timer_event_t sleep_timer;      // Wakes the process from a sleep
     
     // Statistics
     uint32_t time_created;          // Tick when process was created
@@ -92,7 +103,7 @@ typedef struct process {
 } process_t;
 
 // Process table and current process
-extern process_t process_table[MAX_PROCESSES];
+extern process_t* process_table[MAX_PROCESSES];   // NULL = free slot
 extern process_t* current_process;
 extern uint32_t next_pid;
 
@@ -103,6 +114,10 @@ process_t* process_create(const char* name, void (*entry_point)(void),
 void process_destroy(process_t* process);
 void process_exit(int exit_code);
 
+// Create a child sharing the parent's user memory copy-on-write. The
+// caller sets up the child's registers.
+process_t* process_fork(process_t* parent);
+
 // Process state management
 void process_set_state(process_t* process, process_state_t state);
 const char* process_get_state_name(process_state_t state);
@@ -112,6 +127,9 @@ process_t* process_get_current(void);
 void process_set_current(process_t* process);
 process_t* process_get_by_pid(uint32_t pid);
 
+// Per-process scratch arena, created on first use and freed with the process
+arena_t* process_get_arena(process_t* process);
+
 // PID allocation
 uint32_t process_allocate_pid(void);
 void process_free_pid(uint32_t pid);
@@ -0,0 +1,42 @@
+// rbtree.h - Intrusive red-black trees
+// Nodes are embedded in the objects they order. The caller walks down the
+// tree with its own comparison to find where a new node goes, links it there
+// with rb_insert() and the tree rebalances itself. The leftmost node is
+// cached, so the minimum is available in O(1).
+#ifndef RBTREE_H
+#define RBTREE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef struct rb_node {
+    struct rb_node* parent;
+    struct rb_node* left;
+    struct rb_node* right;
+    int red;
+} rb_node_t;
+
+typedef struct {
+    rb_node_t* root;
+    rb_node_t* leftmost;        // Smallest node (NULL when empty)
+} rb_tree_t;
+
+// Object containing the node
+#define rb_entry(node, type, member) \
+    ((type*)((uint8_t*)(node) - offsetof(type, member)))
+
+// Link node as a child of parent at *link (&parent->left, &parent->right or
+// &tree->root when empty), then rebalance. leftmost tells whether the walk
+// only ever went left, i.e. node is the new minimum.
+void rb_insert(rb_tree_t* tree, rb_node_t* node, rb_node_t* parent,
+               rb_node_t** link, int leftmost);
+void rb_erase(rb_tree_t* tree, rb_node_t* node);
+
+static inline rb_node_t* rb_first(const rb_tree_t* tree) {
+    return tree->leftmost;
+}
+
+// In-order successor (NULL for the largest node)
+rb_node_t* rb_next(const rb_node_t* node);
+
+#endif // RBTREE_H
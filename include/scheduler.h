@@ -5,6 +5,27 @@
 #include <stdint.h>
 #include <process.h>
 
+// One run queue per process_priority_t level
+#define SCHED_PRIORITY_LEVELS   (PROCESS_PRIORITY_REALTIME + 1)
+
+// Scheduling policies
+// PRIORITY always runs the highest ready priority level, round-robin within
+// a level. FAIR runs the ready process with the smallest virtual runtime:
+// CPU time scaled down by a weight that grows with priority, so every
+// process progresses and higher priorities get a larger share.
+typedef enum {
+    SCHED_POLICY_PRIORITY = 0,
+    SCHED_POLICY_FAIR
+} sched_policy_t;
+
+// Weight of PROCESS_PRIORITY_NORMAL; one tick adds
+// SCHED_FAIR_WEIGHT_NORMAL * SCHED_FAIR_TICK / weight to vruntime
+#define SCHED_FAIR_WEIGHT_NORMAL    1024
+#define SCHED_FAIR_TICK             1024
+// vruntime lead the running process may have over the leftmost one before
+// it is preempted ahead of its quantum (keeps switches rare)
+#define SCHED_FAIR_GRANULARITY      (4 * SCHED_FAIR_TICK)
+
 // Scheduler initialization
 void scheduler_init(void);
 
@@ -14,9 +35,59 @@ void scheduler_remove_process(process_t* process);
 
 // Scheduling
 process_t* scheduler_schedule(void);
-void scheduler_tick(void);
+void scheduler_tick(uint32_t ticks);      // 'ticks' elapsed since the last call
 void scheduler_yield(void);
 
+// Block the current process for 'ticks' timer ticks (PROCESS_STATE_BLOCKED,
+// woken from the timer wheel). Returns -1 without sleeping when there is
+// nothing else to run the CPU: the scheduler is disabled or the caller is
+// the idle process.
+int scheduler_sleep(uint32_t ticks);
+
+// Make a blocked process ready again (any context)
+void scheduler_wake(process_t* process);
+
+// Wait for the next interrupt. While no other process is ready this first
+// does background work, such as refilling the zeroed frame pool, and only
+// halts once there is none left.
+void scheduler_idle(void);
+
+// Leave the boot context (the idle process, PID 0) for 'process'. The idle
+// process is never queued; it only runs when nothing else is ready.
+void scheduler_run(process_t* process);
+
+// Policy (requeues every ready process when it changes)
+void scheduler_set_policy(sched_policy_t policy);
+sched_policy_t scheduler_get_policy(void);
+const char* scheduler_policy_name(sched_policy_t policy);
+
+// Context switch tracing
+// Every switch appends an event to a fixed ring of SCHED_TRACE_SIZE
+// entries, overwriting the oldest; 'sched trace' dumps it. Recording takes
+// a few stores, so it stays enabled inside the timer interrupt.
+#define SCHED_TRACE_SIZE            256     // Power of two
+
+typedef enum {
+    SCHED_TRACE_QUANTUM = 0,    // Time slice used up
+    SCHED_TRACE_PREEMPT,        // A more deserving process became ready
+    SCHED_TRACE_YIELD,          // scheduler_yield()
+    SCHED_TRACE_BLOCK           // The process went to sleep
+} sched_trace_reason_t;
+
+typedef struct {
+    uint32_t tick;              // timer_get_ticks() at the switch
+    uint16_t old_pid;
+    uint16_t new_pid;
+    uint32_t reason;            // sched_trace_reason_t
+} sched_trace_event_t;
+
+void scheduler_trace_dump(uint32_t max_events);
+void scheduler_trace_clear(void);
+
+// Whether periodic ticks are needed to preempt the running process (false
+// when no other process is ready, which lets the timer skip ticks)
+int scheduler_needs_tick(void);
+
 // Scheduler control
 void scheduler_enable(void);
 void scheduler_disable(void);
@@ -10,6 +10,7 @@ void shell_process_command(const char* command);
 void cmd_help(void);
 void cmd_clear(void);
 void cmd_meminfo(void);
+void cmd_heap(const char* args);
 void cmd_sysinfo(void);
 void cmd_uptime(void);
 void cmd_echo(const char* args);
@@ -3,5 +3,6 @@
 
 typedef unsigned int size_t;
 #define NULL ((void*)0)
+#define offsetof(type, member) __builtin_offsetof(type, member)
 
 #endif // AETHER_STDDEF_H
@@ -9,18 +9,29 @@
 #define SYSCALL_WRITE   2
 #define SYSCALL_READ    3
 #define SYSCALL_YIELD   4
+#define SYSCALL_FORK    5
+#define SYSCALL_SLEEP   6
 
 // Maximum number of syscalls
 #define MAX_SYSCALLS    256
 
+// Stack frame built by syscall_wrapper (syscall_handler.asm)
+typedef struct {
+    uint32_t edi, esi, ebp, esp, ebx, edx, ecx, eax;   // Pushed by pushad
+    uint32_t gs, fs, es, ds;                           // Pushed by the wrapper
+    uint32_t eip, cs, eflags, useresp, ss;             // Pushed by the CPU
+} __attribute__((packed)) syscall_frame_t;
+
 // System call handler
 void syscall_init(void);
-void syscall_handler(registers_t* regs);
+void syscall_handler(syscall_frame_t* regs);
 
 // System call implementations
 int sys_exit(int status);
 int sys_write(int fd, const char* buf, uint32_t len);
 int sys_read(int fd, char* buf, uint32_t len);
 int sys_yield(void);
+int sys_fork(const syscall_frame_t* regs);
+int sys_sleep(uint32_t milliseconds);
 
 #endif // SYSCALL_H
@@ -11,6 +11,34 @@ void timer_init(uint32_t frequency_hz);
 uint32_t timer_get_ticks(void);
 uint32_t timer_get_uptime_seconds(void);
 uint32_t timer_get_frequency(void);
+uint32_t timer_get_interrupts(void);
+uint32_t timer_ms_to_ticks(uint32_t milliseconds);
+
+// Resume periodic ticks within one tick (call when a process becomes
+// ready while the timer may be in a multi-tick one-shot)
+void timer_restart_tick(void);
+
+// Timer events
+// A callback to run from the timer interrupt (with interrupts disabled) a
+// number of ticks from now; used for sleeps and kernel timeouts. The
+// event is owned by the caller and must stay valid while pending.
+typedef struct timer_event {
+    struct timer_event* next;
+    struct timer_event** pprev;     // Link pointing at this event (NULL: not pending)
+    uint32_t expires;               // Tick at which it fires
+    void (*callback)(struct timer_event* event);
+    void* data;                     // For the callback
+} timer_event_t;
+
+void timer_event_init(timer_event_t* event, void (*callback)(timer_event_t* event),
+                      void* data);
+void timer_event_add(timer_event_t* event, uint32_t ticks);  // Re-arms if pending
+int timer_event_cancel(timer_event_t* event);                // 1 if it was pending
+uint32_t timer_get_pending_events(void);
+
+static inline int timer_event_pending(const timer_event_t* event) {
+    return event->pprev != 0;
+}
 
 // Sleep functions
 void timer_sleep_ticks(uint32_t ticks);
@@ -35,12 +35,16 @@ typedef struct {
     uint16_t iomap_base; // I/O map base address
 } __attribute__((packed)) tss_entry_t;
 
+// GDT selector of the double fault task's TSS (entry 6)
+#define TSS_DOUBLE_FAULT_SELECTOR   0x30
+
 // Global TSS entry
 extern tss_entry_t kernel_tss;
 
 // TSS management functions
 void tss_init(uint32_t kernel_stack);
 void tss_set_kernel_stack(uint32_t stack);
+void tss_set_double_fault_cr3(uint32_t cr3);
 void tss_flush(void);
 
 #endif // TSS_H
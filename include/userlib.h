@@ -65,6 +65,37 @@ static inline void yield(void) {
     );
 }
 
+// Create a child process sharing this one's memory copy-on-write.
+// Returns the child's PID in the parent and 0 in the child.
+static inline int fork(void) {
+    int ret;
+    asm volatile(
+        "mov $5, %%eax\n"      // Syscall number 5 (fork)
+        "int $0x80\n"          // Invoke syscall
+        "mov %%eax, %0"        // Get return value
+        : "=r"(ret)
+        :
+        : "eax", "memory"
+    );
+    return ret;
+}
+
+// Block for at least 'ms' milliseconds, letting other processes run.
+// Returns 0, or -1 if there is nothing else to run (scheduler stopped).
+static inline int sleep(uint32_t ms) {
+    int ret;
+    asm volatile(
+        "mov $6, %%eax\n"      // Syscall number 6 (sleep)
+        "mov %1, %%ebx\n"      // Argument: milliseconds
+        "int $0x80\n"          // Invoke syscall
+        "mov %%eax, %0"        // Get return value
+        : "=r"(ret)
+        : "r"(ms)
+        : "eax", "ebx"
+    );
+    return ret;
+}
+
 // Helper: strlen
 static inline uint32_t strlen(const char* str) {
     uint32_t len = 0;
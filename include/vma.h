@@ -0,0 +1,59 @@
+// vma.h - Virtual memory areas of user address spaces
+// A process reserves ranges of its address space as VMAs. Frames are only
+// allocated when a page of a VMA is first touched: the page fault handler
+// finds the VMA, maps a zeroed frame and restarts the faulting instruction.
+#ifndef VMA_H
+#define VMA_H
+
+#include <stdint.h>
+#include <process.h>
+
+// User part of every address space: everything below the kernel half except
+// the first 4MB, left unmapped to catch null pointer dereferences
+#define USER_SPACE_START    0x00400000
+#define USER_SPACE_END      KERNEL_VIRTUAL_BASE
+
+// Layout of user mode processes
+#define USER_CODE_BASE      USER_SPACE_START
+#define USER_STACK_TOP      USER_SPACE_END
+#define USER_STACK_RESERVE  0x100000    // 1MB reserved, populated on demand
+
+// VMA flags
+#define VMA_READ            0x01
+#define VMA_WRITE           0x02
+#define VMA_EXEC            0x04
+
+typedef struct vma {
+    uint32_t start;             // First address (page aligned)
+    uint32_t end;               // One past the last address (page aligned)
+    uint32_t flags;             // VMA_* flags
+    uint32_t resident_pages;    // Pages currently backed by a frame
+    struct vma* next;           // Next VMA of the process, by address
+} vma_t;
+
+void vma_init(void);
+
+// Reserve [start, start + size) in the process's address space. No memory
+// is allocated until the range is touched. Returns NULL if the range is
+// outside user space or overlaps an existing VMA.
+vma_t* vma_reserve(process_t* process, uint32_t start, uint32_t size, uint32_t flags);
+vma_t* vma_find(process_t* process, uint32_t addr);
+
+// Fill part of a VMA from kernel memory, populating the pages it covers
+int vma_copy_in(process_t* process, uint32_t addr, const void* data, uint32_t size);
+
+// Resolve a fault on a not-present page (zero fill) or a write to a
+// copy-on-write page (private copy). Returns 1 if the access can be
+// retried, 0 if the address is not covered by a VMA allowing the access.
+int vma_handle_fault(process_t* process, uint32_t addr, uint32_t error_code);
+
+// Give dst the same VMAs as src; their pages are shared by
+// paging_clone_directory()
+int vma_clone(process_t* src, process_t* dst);
+
+// Unmap every VMA, freeing the frames behind them
+void vma_release_all(process_t* process);
+
+void vma_print(process_t* process);
+
+#endif // VMA_H
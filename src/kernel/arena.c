@@ -0,0 +1,132 @@
+// arena.c - Bump-pointer arenas backed by physical frames
+// Chunks come straight from the frame allocator (RAM is mapped in the kernel
+// half), so arena traffic never touches the block heap's free lists.
+#include <arena.h>
+#include <memory.h>
+#include <pmm.h>
+#include <printk.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#define ARENA_HEADER_SIZE   ((sizeof(arena_chunk_t) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1))
+
+static arena_chunk_t* chunk_alloc(uint32_t min_size) {
+    // Smallest power-of-two run of frames holding the header and min_size
+    uint32_t order = 0;
+    while (order <= PMM_MAX_ORDER && ((uint32_t)PAGE_SIZE << order) < ARENA_HEADER_SIZE + min_size) {
+        order++;
+    }
+    if (order > PMM_MAX_ORDER) {
+        return NULL;
+    }
+
+    uint32_t frames = pmm_alloc_frames(order);
+    if (!frames) {
+        return NULL;
+    }
+
+    arena_chunk_t* chunk = (arena_chunk_t*)phys_to_virt(frames);
+    chunk->prev = NULL;
+    chunk->order = order;
+    chunk->used = ARENA_HEADER_SIZE;
+    chunk->size = (uint32_t)PAGE_SIZE << order;
+    return chunk;
+}
+
+static void chunk_free(arena_chunk_t* chunk) {
+    pmm_free_frames(virt_to_phys(chunk), chunk->order);
+}
+
+arena_t* arena_create(void) {
+    arena_chunk_t* chunk = chunk_alloc(sizeof(arena_t));
+    if (!chunk) {
+        printk_error("arena: out of physical memory");
+        return NULL;
+    }
+
+    arena_t* arena = (arena_t*)((uint8_t*)chunk + chunk->used);
+    chunk->used += (sizeof(arena_t) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+
+    memset(arena, 0, sizeof(arena_t));
+    arena->current = chunk;
+    arena->first = chunk;
+    arena->chunks = 1;
+    return arena;
+}
+
+void* arena_alloc(arena_t* arena, size_t size) {
+    if (!arena || size == 0) {
+        return NULL;
+    }
+
+    size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+
+    arena_chunk_t* chunk = arena->current;
+    if (chunk->size - chunk->used < size) {
+        // Current chunk is full: continue in a new one large enough
+        arena_chunk_t* next = chunk_alloc(size);
+        if (!next) {
+            return NULL;
+        }
+        next->prev = chunk;
+        arena->current = next;
+        arena->chunks++;
+        chunk = next;
+    }
+
+    void* ptr = (uint8_t*)chunk + chunk->used;
+    chunk->used += size;
+
+    arena->allocated += size;
+    if (arena->allocated > arena->peak) {
+        arena->peak = arena->allocated;
+    }
+    return ptr;
+}
+
+void* arena_calloc(arena_t* arena, size_t size) {
+    void* ptr = arena_alloc(arena, size);
+    if (ptr) {
+        memset(ptr, 0, size);
+    }
+    return ptr;
+}
+
+void arena_reset(arena_t* arena) {
+    if (!arena) {
+        return;
+    }
+
+    // Hand back every chunk but the first, which holds the arena itself
+    arena_chunk_t* chunk = arena->current;
+    while (chunk != arena->first) {
+        arena_chunk_t* prev = chunk->prev;
+        chunk_free(chunk);
+        chunk = prev;
+    }
+
+    chunk->used = ARENA_HEADER_SIZE +
+                  ((sizeof(arena_t) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1));
+    arena->current = chunk;
+    arena->chunks = 1;
+    arena->allocated = 0;
+    arena->resets++;
+}
+
+void arena_destroy(arena_t* arena) {
+    if (!arena) {
+        return;
+    }
+
+    arena_reset(arena);
+    chunk_free(arena->first);
+}
+
+void arena_print_stats(const arena_t* arena) {
+    if (!arena) {
+        return;
+    }
+
+    printk("  Arena %p: %u bytes in use, peak %u, %u chunk(s), %u resets\n",
+           arena, arena->allocated, arena->peak, arena->chunks, arena->resets);
+}
@@ -9,6 +9,10 @@ global read_esp
 global read_ebp
 global read_eip
 
+; Address-space switch counters (defined in scheduler.c)
+extern context_cr3_reloads
+extern context_cr3_skips
+
 ; void context_switch(registers_t* old_regs, registers_t* new_regs)
 ; Save current context to old_regs, restore context from new_regs
 ; 
@@ -99,8 +103,18 @@ context_switch:
     jz .done                ; Safety check
     
     ; Restore CR3 (page directory) - switch address space
+    ; Writing CR3 flushes every non-global TLB entry, so skip it when the
+    ; new context runs in the address space that is already loaded
     mov eax, [edx+60]       ; CR3
+    mov ecx, cr3
+    cmp eax, ecx
+    je .same_address_space
     mov cr3, eax
+    inc dword [context_cr3_reloads]
+    jmp .address_space_done
+.same_address_space:
+    inc dword [context_cr3_skips]
+.address_space_done:
     
     ; Check if this is a user mode process FIRST
     mov ax, [edx+32]        ; Get DS (for user mode, will be 0x23)
@@ -0,0 +1,87 @@
+// cpu.c - CPU feature detection
+#include <cpu.h>
+#include <printk.h>
+#include <stdint.h>
+
+uint32_t cpu_features = 0;
+
+static void cpuid(uint32_t leaf, uint32_t* eax, uint32_t* ebx,
+                  uint32_t* ecx, uint32_t* edx) {
+    __asm__ volatile("cpuid"
+                     : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx)
+                     : "a"(leaf), "c"(0));
+}
+
+// CPUID exists if the ID bit (21) of EFLAGS can be toggled
+static int cpuid_supported(void) {
+    uint32_t before, after;
+    __asm__ volatile(
+        "pushfl\n\t"
+        "pushfl\n\t"
+        "popl %0\n\t"
+        "movl %0, %1\n\t"
+        "xorl $0x200000, %1\n\t"
+        "pushl %1\n\t"
+        "popfl\n\t"
+        "pushfl\n\t"
+        "popl %1\n\t"
+        "popfl"
+        : "=&r"(before), "=&r"(after));
+    return ((before ^ after) & 0x200000) != 0;
+}
+
+void cpu_init(void) {
+    printk_info("Detecting CPU features");
+    
+    if (!cpuid_supported()) {
+        printk_warn("CPUID not supported, using baseline i386 paths");
+        return;
+    }
+    
+    uint32_t max_leaf, ebx, ecx, edx;
+    char vendor[13];
+    cpuid(0, &max_leaf, &ebx, &ecx, &edx);
+    *(uint32_t*)&vendor[0] = ebx;
+    *(uint32_t*)&vendor[4] = edx;
+    *(uint32_t*)&vendor[8] = ecx;
+    vendor[12] = '\0';
+    
+    cpu_features = CPU_FEATURE_CPUID;
+    if (max_leaf >= 1) {
+        uint32_t eax;
+        cpuid(1, &eax, &ebx, &ecx, &edx);
+        if (edx & CPUID_EDX_PSE)  cpu_features |= CPU_FEATURE_PSE;
+        if (edx & CPUID_EDX_PGE)  cpu_features |= CPU_FEATURE_PGE;
+        if (edx & CPUID_EDX_FXSR) cpu_features |= CPU_FEATURE_FXSR;
+        if (edx & CPUID_EDX_SSE)  cpu_features |= CPU_FEATURE_SSE;
+        if (edx & CPUID_EDX_SSE2) cpu_features |= CPU_FEATURE_SSE2;
+    }
+    
+    // SSE instructions fault until the OS declares FXSAVE support in CR4
+    // and the x87 emulation bit is clear. The kernel never sets CR0.TS, so
+    // XMM registers are usable without a lazy-FPU trap.
+    if (cpu_has(CPU_FEATURE_FXSR) && cpu_has(CPU_FEATURE_SSE2)) {
+        cpu_write_cr0((cpu_read_cr0() & ~CR0_EM) | CR0_MP);
+        cpu_write_cr4(cpu_read_cr4() | CR4_OSFXSR | CR4_OSXMMEXCPT);
+        cpu_features |= CPU_FEATURE_SSE_ENABLED;
+    }
+    
+    printk("  Vendor: %s\n", vendor);
+    printk("  Features:%s%s%s%s\n",
+           cpu_has(CPU_FEATURE_PSE) ? " pse" : "",
+           cpu_has(CPU_FEATURE_PGE) ? " pge" : "",
+           cpu_has(CPU_FEATURE_SSE) ? " sse" : "",
+           cpu_has(CPU_FEATURE_SSE2) ? " sse2" : "");
+}
+
+uint32_t cpu_irq_save(void) {
+    uint32_t eflags;
+    __asm__ volatile("pushf; pop %0; cli" : "=r"(eflags) : : "memory");
+    return eflags;
+}
+
+void cpu_irq_restore(uint32_t eflags) {
+    if (eflags & 0x200) {
+        __asm__ volatile("sti" : : : "memory");
+    }
+}
@@ -20,8 +20,9 @@ struct gdt_ptr {
     uint32_t base;         // Address of GDT
 } __attribute__((packed));
 
-// GDT with 6 entries: null, kernel code, kernel data, user code, user data, TSS
-#define GDT_ENTRIES 6
+// GDT with 7 entries: null, kernel code, kernel data, user code, user data, TSS,
+// double fault TSS (entry 6)
+#define GDT_ENTRIES 7
 static struct gdt_entry gdt[GDT_ENTRIES];
 static struct gdt_ptr gdt_pointer;
 
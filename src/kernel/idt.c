@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 #include <printk.h>
+#include <tss.h>
 
 // IDT Entry structure
 struct idt_entry {
@@ -30,6 +31,7 @@ static struct idt_ptr idt_pointer;
 #define IDT_RING3       (3 << 5)
 #define IDT_INT_GATE    0x0E    // 32-bit interrupt gate
 #define IDT_TRAP_GATE   0x0F    // 32-bit trap gate
+#define IDT_TASK_GATE   0x05    // Task gate (switches to the TSS in 'selector')
 
 // Exception handler declarations (implemented in idt_handlers.asm)
 extern void isr0(void);   // Division by Zero
@@ -123,7 +125,8 @@ void idt_init(void) {
     idt_set_gate(5,  (uint32_t)isr5,  kernel_cs, IDT_PRESENT | IDT_RING0 | IDT_INT_GATE);
     idt_set_gate(6,  (uint32_t)isr6,  kernel_cs, IDT_PRESENT | IDT_RING0 | IDT_INT_GATE);
     idt_set_gate(7,  (uint32_t)isr7,  kernel_cs, IDT_PRESENT | IDT_RING0 | IDT_INT_GATE);
-    idt_set_gate(8,  (uint32_t)isr8,  kernel_cs, IDT_PRESENT | IDT_RING0 | IDT_INT_GATE);
+    // Double faults switch to a dedicated task with its own stack (see tss.c)
+    idt_set_gate(8,  0, TSS_DOUBLE_FAULT_SELECTOR, IDT_PRESENT | IDT_RING0 | IDT_TASK_GATE);
     idt_set_gate(9,  (uint32_t)isr9,  kernel_cs, IDT_PRESENT | IDT_RING0 | IDT_INT_GATE);
     idt_set_gate(10, (uint32_t)isr10, kernel_cs, IDT_PRESENT | IDT_RING0 | IDT_INT_GATE);
     idt_set_gate(11, (uint32_t)isr11, kernel_cs, IDT_PRESENT | IDT_RING0 | IDT_INT_GATE);
@@ -8,7 +8,10 @@
 #include <idt.h>
 #include <pic.h>
 #include <timer.h>
+#include <cpu.h>
 #include <memory.h>
+#include <pmm.h>
+#include <multiboot.h>
 #include <keyboard.h>
 #include <shell.h>
 #include <paging.h>
@@ -19,7 +22,38 @@ static inline void outb(uint16_t port, uint8_t val) {
     __asm__ volatile ("outb %0, %1" : : "a"(val), "Nd"(port));
 }
 
-void kmain(void) {
+// Usable RAM reported by the bootloader
+static boot_memory_map_t boot_memory;
+static uint32_t kernel_heap_size = 0;
+
+// Place the heap after the kernel image and the page tables paging_init()
+// built (image_end, physical) and the frame table after the heap, sizing both
+// from the memory the bootloader reported
+static void memory_layout_init(uint32_t image_end) {
+    uint32_t heap_base = PAGE_ALIGN(image_end);
+    if (heap_base < KERNEL_HEAP_START) {
+        heap_base = KERNEL_HEAP_START;
+    }
+    
+    uint32_t heap_size = boot_memory.usable_memory / KERNEL_HEAP_RAM_DIV;
+    if (heap_size < KERNEL_HEAP_SIZE) heap_size = KERNEL_HEAP_SIZE;
+    if (heap_size > KERNEL_HEAP_MAX) heap_size = KERNEL_HEAP_MAX;
+    heap_size &= ~(0x100000 - 1);  // Whole megabytes
+    
+    memory_init((uint32_t)phys_to_virt(heap_base), heap_size);
+    kernel_heap_size = heap_size;
+    
+    // Frame table goes right after the heap; everything below its end
+    // (kernel image, heap) is withheld from the frame allocator
+    uint32_t frames_base = heap_base + heap_size;
+    pmm_init(boot_memory.memory_end, frames_base);
+    for (uint32_t i = 0; i < boot_memory.region_count; i++) {
+        pmm_add_region(boot_memory.regions[i].base, boot_memory.regions[i].length);
+    }
+    pmm_reserve_region(KERNEL_START, frames_base - KERNEL_START);
+}
+
+void kmain(uint32_t multiboot_magic, uint32_t multiboot_info) {
     // Clear screen and set up console
     console_clear();
     
@@ -48,6 +82,9 @@ void kmain(void) {
     // Phase 1: Initialize core kernel subsystems
     printk_info("Phase 1: Kernel Foundation Initialization");
     
+    // Detect CPU features (SSE, PSE, PGE) before anything depends on them
+    cpu_init();
+    
     // Initialize GDT (Global Descriptor Table)
     gdt_init();
     
@@ -64,17 +101,34 @@ void kmain(void) {
     // Initialize Timer (100 Hz = 10ms intervals)
     timer_init(100);
     
-    // Initialize Memory Manager
-    memory_init();
+    // Read the memory map before anything overwrites the boot information
+    // (the boot page tables map it at its physical address + KERNEL_VIRTUAL_BASE)
+    multiboot_parse(multiboot_magic,
+                    multiboot_info ? phys_to_virt(multiboot_info) : NULL,
+                    &boot_memory);
+    int fair_scheduling = multiboot_has_option(multiboot_magic,
+                              multiboot_info ? phys_to_virt(multiboot_info) : NULL,
+                              "sched=fair");
     
     // Initialize Paging (Virtual Memory) - Phase 4 Step 1
-    paging_init();
+    // Map all RAM into the kernel half before the heap and frame table,
+    // which may lie beyond the boot mapping, are touched
+    uint32_t image_end = paging_init(boot_memory.memory_end);
+    
+    // Initialize Memory Manager and Physical Memory Manager
+    memory_layout_init(image_end);
+    
+    // Object caches and protection features need the heap
+    paging_enable();
     
     // Initialize Process Management - Phase 4 Step 3
     process_init();
     
     // Initialize Scheduler - Phase 4 Step 4
     scheduler_init();
+    if (fair_scheduling) {
+        scheduler_set_policy(SCHED_POLICY_FAIR);
+    }
     
     // Initialize User Mode - Phase 5 Step 1
     extern void usermode_init(void);
@@ -93,21 +147,25 @@ void kmain(void) {
     
     // Subsystem initialization status
     printk("\nSubsystem Status:\n");
+    printk("  [DONE] CPU - Feature detection (SSE2 string ops when available)\n");
     printk("  [DONE] GDT - Global Descriptor Table (with TSS)\n");
     printk("  [DONE] TSS - Task State Segment\n");
     printk("  [DONE] IDT - Interrupt Descriptor Table (exceptions + IRQs)\n");
     printk("  [DONE] PIC - Programmable Interrupt Controller\n");
     printk("  [DONE] PIT - Programmable Interval Timer (100 Hz)\n");
-    printk("  [DONE] Memory - Kernel Heap Allocator (4MB)\n");
-    printk("  [DONE] Paging - Virtual Memory (initialized, not yet enabled)\n");
+    printk("  [DONE] Memory - Kernel Heap Allocator (%u MB)\n",
+           kernel_heap_size / (1024 * 1024));
+    printk("  [DONE] PMM - Buddy Page Frame Allocator\n");
+    printk("  [DONE] Paging - Virtual Memory (enabled, guarded kernel stacks)\n");
     printk("  [DONE] Process - PCB and Process Management\n");
-    printk("  [DONE] Scheduler - Round-Robin Scheduling (ready)\n");
+    printk("  [DONE] Scheduler - %s Scheduling (ready)\n",
+           scheduler_policy_name(scheduler_get_policy()));
     printk("  [DONE] User Mode - Ring 3 execution support\n");
     printk("  [DONE] System Calls - INT 0x80 interface\n");
     printk("  [DONE] Keyboard - PS/2 Driver\n");
-    printk("  [TODO] Paging Enable - Activate virtual memory\n");
     printk("  [DONE] Context Switch - Process multitasking (with TSS!)\n");
-    printk("  [TODO] fork/exec/wait - Process lifecycle (Phase 5 Step 3)\n");
+    printk("  [DONE] fork - Copy-on-write process duplication\n");
+    printk("  [TODO] exec/wait - Process lifecycle (Phase 5 Step 3)\n");
     printk("  [TODO] VFS - Virtual File System\n");
     printk("  [TODO] Drivers - Hardware Abstraction\n");
     
@@ -123,5 +181,18 @@ void kmain(void) {
     timer_sleep_ms(500);
     
     shell_init();
-    shell_run(); // This runs forever, handling user input
+    
+    // The shell runs as a NORMAL-priority process so that it keeps its share
+    // of the CPU next to busy processes. This context becomes the idle
+    // process, which only runs when nothing else is ready.
+    process_t* shell = process_create("shell", shell_run, PROCESS_PRIORITY_NORMAL);
+    if (shell) {
+        scheduler_run(shell);
+    } else {
+        shell_run(); // This runs forever, handling user input
+    }
+    
+    while (1) {
+        scheduler_idle();
+    }
 }
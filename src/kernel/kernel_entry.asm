@@ -1,25 +1,81 @@
-; kernel_entry.asm - Simple entry point for 32-bit kernel
-; Let's start with 32-bit and get it working first
+; kernel_entry.asm - Entry point for the higher-half kernel
+; GRUB jumps to _start at its physical load address with paging off, but the
+; kernel is linked at KERNEL_VIRTUAL_BASE. The boot code maps the first
+; BOOT_MAP_TABLES * 4MB of RAM both at 0 (where it is running) and at
+; KERNEL_VIRTUAL_BASE, enables paging and jumps to the higher half.
+; paging_init() later replaces these tables and drops the low mapping.
 
 BITS 32
-SECTION .text
+
+KERNEL_VIRTUAL_BASE equ 0xC0000000     ; Must match memory.h and linker.ld
+KERNEL_PDE_INDEX    equ KERNEL_VIRTUAL_BASE >> 22
+BOOT_MAP_TABLES     equ 2               ; 8MB (KERNEL_BOOT_MAP_END in memory.h)
+PAGE_PRESENT_WRITE  equ 0x003
+CR0_PG              equ 0x80000000
+
+extern __bss_start
+extern __bss_end
+extern kmain
+
+SECTION .boot progbits alloc exec nowrite align=16
 GLOBAL _start
-EXTERN kmain
 
 _start:
-    ; Set up a simple stack
-    mov esp, stack_top
+    ; Keep the Multiboot magic (EAX) and info pointer (EBX) across the setup
+    mov esi, eax
+    cld
 
-    ; Clear BSS
-    extern __bss_start
-    extern __bss_end
-    mov edi, __bss_start
-    mov ecx, __bss_end
+    ; Clear BSS through its load address; the boot page tables live there
+    mov edi, __bss_start - KERNEL_VIRTUAL_BASE
+    mov ecx, __bss_end - KERNEL_VIRTUAL_BASE
     sub ecx, edi
     xor eax, eax
+    mov edx, ecx
+    shr ecx, 2                  ; BSS starts page aligned: clear dwords first
+    rep stosd
+    mov ecx, edx
+    and ecx, 3
     rep stosb
 
-    ; Call C kernel main
+    ; Fill the boot page tables with consecutive frames starting at 0
+    mov edi, boot_page_tables - KERNEL_VIRTUAL_BASE
+    mov eax, PAGE_PRESENT_WRITE
+    mov ecx, BOOT_MAP_TABLES * 1024
+.fill_tables:
+    stosd
+    add eax, 0x1000
+    loop .fill_tables
+
+    ; Install them at 0 and at KERNEL_VIRTUAL_BASE
+    mov edi, boot_page_directory - KERNEL_VIRTUAL_BASE
+    mov eax, (boot_page_tables - KERNEL_VIRTUAL_BASE) + PAGE_PRESENT_WRITE
+    xor ecx, ecx
+.fill_directory:
+    mov [edi + ecx * 4], eax
+    mov [edi + ecx * 4 + KERNEL_PDE_INDEX * 4], eax
+    add eax, 0x1000
+    inc ecx
+    cmp ecx, BOOT_MAP_TABLES
+    jb .fill_directory
+
+    ; Enable paging and continue at the linked (higher-half) address
+    mov cr3, edi
+    mov eax, cr0
+    or eax, CR0_PG
+    mov cr0, eax
+
+    mov eax, higher_half
+    jmp eax
+
+SECTION .text
+
+higher_half:
+    ; Set up a simple stack
+    mov esp, stack_top
+
+    ; Call C kernel main: kmain(magic, physical address of the multiboot info)
+    push ebx
+    push esi
     call kmain
 
 .hang:
@@ -27,6 +83,12 @@ _start:
     hlt
     jmp .hang
 
+SECTION .bss.boot nobits alloc noexec write align=4096
+boot_page_directory:
+    resb 4096
+boot_page_tables:
+    resb 4096 * BOOT_MAP_TABLES
+
 SECTION .bss
     align 16
 stack_bottom:
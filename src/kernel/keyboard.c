@@ -2,6 +2,7 @@
 #include <keyboard.h>
 #include <printk.h>
 #include <timer.h>
+#include <scheduler.h>
 #include <stdint.h>
 
 // US QWERTY keyboard layout
@@ -205,7 +206,7 @@ void console_readline(char* buffer, int max_len) {
         char c = keyboard_getchar();
         if (c == 0) {
             // No input available, yield CPU
-            __asm__ volatile("hlt");
+            scheduler_idle();
             continue;
         }
         
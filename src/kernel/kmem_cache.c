@@ -0,0 +1,139 @@
+// kmem_cache.c - Typed object caches over the heap and frame allocator
+#include <kmem_cache.h>
+#include <memory.h>
+#include <pmm.h>
+#include <printk.h>
+#include <stdint.h>
+#include <stddef.h>
+
+static kmem_cache_t* cache_list = NULL;
+
+// Caches such as the page table cache are also used from the page fault
+// handler, so free arrays and counters only change with interrupts disabled
+static inline uint32_t irq_save(void) {
+    uint32_t eflags;
+    __asm__ volatile("pushf; pop %0; cli" : "=r"(eflags) : : "memory");
+    return eflags;
+}
+
+static inline void irq_restore(uint32_t eflags) {
+    if (eflags & 0x200) {
+        __asm__ volatile("sti" : : : "memory");
+    }
+}
+
+void kmem_ctor_zero(void* object, size_t size) {
+    memset(object, 0, size);
+}
+
+kmem_cache_t* kmem_cache_create(const char* name, size_t object_size,
+                                kmem_ctor_t ctor, uint32_t flags) {
+    if (object_size == 0 ||
+        ((flags & KMEM_CACHE_FRAMES) && object_size > PAGE_SIZE)) {
+        printk_error("kmem_cache: invalid object size %u for '%s'",
+                     object_size, name);
+        return NULL;
+    }
+    
+    kmem_cache_t* cache = (kmem_cache_t*)kcalloc(1, sizeof(kmem_cache_t));
+    if (!cache) {
+        return NULL;
+    }
+    
+    cache->name = name;
+    cache->object_size = object_size;
+    cache->flags = flags;
+    cache->ctor = ctor;
+    
+    cache->next = cache_list;
+    cache_list = cache;
+    return cache;
+}
+
+static void* backend_alloc(kmem_cache_t* cache) {
+    if (cache->flags & KMEM_CACHE_FRAMES) {
+        uint32_t frame = pmm_alloc_zeroed_frame();
+        return frame ? phys_to_virt(frame) : NULL;
+    }
+    return kmalloc(cache->object_size);
+}
+
+static void backend_free(kmem_cache_t* cache, void* object) {
+    if (cache->flags & KMEM_CACHE_FRAMES) {
+        pmm_free_frame(virt_to_phys(object));
+    } else {
+        kfree(object);
+    }
+}
+
+void* kmem_cache_alloc(kmem_cache_t* cache) {
+    void* object = NULL;
+    
+    uint32_t eflags = irq_save();
+    if (cache->free_count > 0) {
+        object = cache->free_objects[--cache->free_count];
+        cache->recycled++;
+    }
+    irq_restore(eflags);
+    
+    if (!object) {
+        object = backend_alloc(cache);
+        if (!object) {
+            return NULL;
+        }
+        // Frames arrive zeroed (from the pool when it has any), which is
+        // all the zero constructor would do
+        if (cache->ctor && !(cache->ctor == kmem_ctor_zero &&
+                             (cache->flags & KMEM_CACHE_FRAMES))) {
+            cache->ctor(object, cache->object_size);
+        }
+    }
+    
+    eflags = irq_save();
+    cache->objects_in_use++;
+    cache->allocations++;
+    irq_restore(eflags);
+    return object;
+}
+
+void kmem_cache_free(kmem_cache_t* cache, void* object) {
+    if (!object) {
+        return;
+    }
+    
+    uint32_t eflags = irq_save();
+    cache->objects_in_use--;
+    int cached = cache->free_count < KMEM_CACHE_MAX_FREE;
+    if (cached) {
+        cache->free_objects[cache->free_count++] = object;
+    }
+    irq_restore(eflags);
+    
+    if (!cached) {
+        backend_free(cache, object);
+    }
+}
+
+void kmem_cache_shrink(kmem_cache_t* cache) {
+    while (1) {
+        uint32_t eflags = irq_save();
+        void* object = cache->free_count > 0 ?
+                       cache->free_objects[--cache->free_count] : NULL;
+        irq_restore(eflags);
+        
+        if (!object) {
+            break;
+        }
+        backend_free(cache, object);
+    }
+}
+
+void kmem_cache_print_stats(void) {
+    printk("\nObject Caches:\n");
+    printk("  Name\t\tSize\tIn use\tFree\tAllocs\tRecycled\n");
+    for (kmem_cache_t* cache = cache_list; cache; cache = cache->next) {
+        printk("  %s\t%u\t%u\t%u\t%u\t%u\n",
+               cache->name, cache->object_size, cache->objects_in_use,
+               cache->free_count, cache->allocations, cache->recycled);
+    }
+}
@@ -1,134 +1,707 @@
-// memory.c - Basic Memory Manager for Aether OS
+// memory.c - Kernel heap for Aether OS (slab caches over a TLSF block heap)
 #include <memory.h>
+#include <cpu.h>
 #include <printk.h>
 #include <stdint.h>
 #include <stddef.h>
 
 // Heap management globals
 static memory_block_t* heap_start = NULL;
-static memory_block_t* heap_end = NULL;
+static memory_block_t* heap_end = NULL;     // Zero-size sentinel after the last block
 static uint32_t total_heap_size = 0;
 static int heap_initialized = 0;
 
-void memory_init(void) {
-    // Initialize the kernel heap at 2MB
-    heap_start = (memory_block_t*)KERNEL_HEAP_START;
-    total_heap_size = KERNEL_HEAP_SIZE;
+// Block heap: two-level segregated fit (TLSF)
+// Free blocks are binned into power-of-two size ranges (first level), each
+// split into SL_COUNT linear sub-ranges (second level). A bitmap bit per
+// non-empty list lets allocation find a fitting list with two find-first-set
+// operations, and boundary tags (prev_phys plus flag bits in size) let free
+// merge both physical neighbours without walking anything, so both are O(1).
+#define BLOCK_FREE          0x1     // This block is free
+#define BLOCK_PREV_FREE     0x2     // The physically previous block is free
+#define BLOCK_FLAGS         0x3
+
+#define BLOCK_ALIGN         4
+#define BLOCK_OVERHEAD      offsetof(memory_block_t, next_free)
+#define BLOCK_MIN_SIZE      (sizeof(memory_block_t) - BLOCK_OVERHEAD)
+
+#define SL_INDEX_LOG2       4
+#define SL_COUNT            (1 << SL_INDEX_LOG2)
+#define FL_INDEX_SHIFT      (SL_INDEX_LOG2 + 2)
+#define FL_INDEX_MAX        30      // Blocks are smaller than 1GB
+#define FL_COUNT            (FL_INDEX_MAX - FL_INDEX_SHIFT + 1)
+#define SMALL_BLOCK_SIZE    (1 << FL_INDEX_SHIFT)
+#define HEAP_ALLOC_MAX      (1u << FL_INDEX_MAX)    // Larger requests fail
+
+static uint32_t fl_bitmap = 0;
+static uint32_t sl_bitmap[FL_COUNT];
+static memory_block_t* free_lists[FL_COUNT][SL_COUNT];
+
+// Block heap counters, maintained as blocks change state so that stats
+// never need to walk the heap
+static uint32_t heap_free_bytes = 0;
+static uint32_t heap_free_count = 0;
+static uint32_t heap_used_bytes = 0;
+static uint32_t heap_used_count = 0;
+static uint32_t fl_free_count[FL_COUNT];    // Free blocks per size range
+
+// Allocation-site profiler
+// While enabled, kmalloc records its caller in a site table and the new
+// pointer in an open-addressed table, so kfree can charge the release back
+// to the site that made it. Allocations from before profiling was turned
+// on are not tracked.
+#define PROFILE_MAX_SITES   64      // Last slot collects all other sites
+#define PROFILE_TABLE_SIZE  4096    // Tracked live allocations (power of two)
+
+typedef struct {
+    uintptr_t site;             // Caller return address
+    uint32_t allocs;
+    uint32_t live_count;
+    uint32_t live_bytes;
+    uint32_t peak_bytes;
+} profile_site_t;
+
+typedef struct {
+    void* ptr;                  // NULL = empty slot
+    uint32_t size;
+    uint32_t site;              // Index into profile_sites
+} profile_entry_t;
+
+static profile_entry_t* profile_table = NULL;
+static uint32_t profile_entries = 0;
+static uint32_t profile_untracked = 0;
+static profile_site_t profile_sites[PROFILE_MAX_SITES];
+static uint32_t profile_site_count = 0;
+
+// Page-aligned heap region (the slab page map sits at its start)
+static uintptr_t heap_base = 0;
+static uint32_t heap_region_size = 0;
+
+// Slab allocator
+// Small requests (16-2048 bytes) are served from per-class slabs carved out
+// of the block heap. Each slab is aligned to its own size, so the owning slab
+// of any object is found by masking the pointer. slab_page_map records which
+// heap pages belong to a slab (class index + 1, 0 = not a slab page).
+#define SLAB_MAGIC          0x51AB51AB
+
+typedef struct slab {
+    uint32_t magic;
+    uint16_t class_index;
+    uint16_t in_use;            // Objects handed out from this slab
+    uint16_t capacity;          // Objects that fit in this slab
+    uint16_t reserved;
+    void* free_list;            // Singly linked list through free objects
+    struct slab* next;          // Next slab with free objects
+    struct slab* prev;
+} slab_t;
+
+typedef struct {
+    uint32_t object_size;
+    uint32_t slab_size;
+    slab_t* partial;            // Slabs with at least one free object
+    uint32_t slabs;
+    uint32_t objects_in_use;
+    uint32_t objects_total;
+} slab_class_t;
+
+static slab_class_t slab_classes[SLAB_NUM_CLASSES];
+static uint8_t* slab_page_map = NULL;
+
+static void* heap_alloc(size_t size);
+static void* heap_alloc_aligned(size_t size, size_t align);
+static void heap_free(void* ptr);
+static void heap_free_block(memory_block_t* block);
+static void slab_init(void);
+
+void memory_init(uint32_t base, uint32_t size) {
+    // The slab page map (one byte per heap page) occupies the start of the
+    // region; the block heap begins right after it
+    heap_base = base;
+    heap_region_size = size;
+    slab_page_map = (uint8_t*)heap_base;
+    uint32_t map_size = ((size / PAGE_SIZE) + 3) & ~3;
+    
+    heap_start = (memory_block_t*)(heap_base + map_size);
+    total_heap_size = size - map_size;
+    
+    fl_bitmap = 0;
+    heap_free_bytes = 0;
+    heap_free_count = 0;
+    heap_used_bytes = 0;
+    heap_used_count = 0;
+    for (int fl = 0; fl < FL_COUNT; fl++) {
+        sl_bitmap[fl] = 0;
+        fl_free_count[fl] = 0;
+        for (int sl = 0; sl < SL_COUNT; sl++) {
+            free_lists[fl][sl] = NULL;
+        }
+    }
     
-    // Create the initial free block
-    heap_start->size = KERNEL_HEAP_SIZE - sizeof(memory_block_t);
-    heap_start->is_free = 1;
-    heap_start->next = NULL;
-    heap_start->prev = NULL;
+    // One free block spanning the heap, followed by a zero-size used
+    // sentinel so that every block has a physical successor
+    heap_end = (memory_block_t*)((uint8_t*)heap_start + total_heap_size - BLOCK_OVERHEAD);
+    heap_start->prev_phys = NULL;
+    heap_start->size = (size_t)((uint8_t*)heap_end - (uint8_t*)heap_start - BLOCK_OVERHEAD);
+    heap_end->prev_phys = heap_start;
+    heap_end->size = 0;
+    heap_free_block(heap_start);
     
-    heap_end = heap_start;
     heap_initialized = 1;
     
+    slab_init();
+    
     printk_info("Memory manager initialized");
-    printk("  Heap start: 0x%x\n", (uint32_t)heap_start);
-    printk("  Heap size:  %u KB\n", KERNEL_HEAP_SIZE / 1024);
+    printk("  Heap start: %p\n", heap_start);
+    printk("  Heap size:  %u KB\n", size / 1024);
+    printk("  Slab classes: %u (%u - %u bytes)\n",
+           SLAB_NUM_CLASSES, SLAB_MIN_SIZE, SLAB_MAX_SIZE);
+}
+
+static inline size_t block_size(const memory_block_t* block) {
+    return block->size & ~(size_t)BLOCK_FLAGS;
+}
+
+static inline int block_is_free(const memory_block_t* block) {
+    return (block->size & BLOCK_FREE) != 0;
+}
+
+static inline void* block_to_ptr(const memory_block_t* block) {
+    return (uint8_t*)block + BLOCK_OVERHEAD;
+}
+
+static inline memory_block_t* block_from_ptr(const void* ptr) {
+    return (memory_block_t*)((uint8_t*)ptr - BLOCK_OVERHEAD);
+}
+
+static inline memory_block_t* block_next(const memory_block_t* block) {
+    return (memory_block_t*)((uint8_t*)block_to_ptr(block) + block_size(block));
+}
+
+// Compute the free list holding blocks of exactly 'size' bytes
+static void mapping_insert(size_t size, int* fl, int* sl) {
+    if (size < SMALL_BLOCK_SIZE) {
+        *fl = 0;
+        *sl = (int)size / (SMALL_BLOCK_SIZE / SL_COUNT);
+    } else {
+        int bit = 31 - __builtin_clz((uint32_t)size);
+        *sl = (int)(size >> (bit - SL_INDEX_LOG2)) ^ SL_COUNT;
+        *fl = bit - (FL_INDEX_SHIFT - 1);
+    }
+}
+
+// Compute the first free list whose blocks are all at least 'size' bytes
+static void mapping_search(size_t size, int* fl, int* sl) {
+    if (size >= SMALL_BLOCK_SIZE) {
+        int bit = 31 - __builtin_clz((uint32_t)size);
+        size += (1u << (bit - SL_INDEX_LOG2)) - 1;
+    }
+    mapping_insert(size, fl, sl);
+}
+
+static void insert_free_block(memory_block_t* block) {
+    int fl, sl;
+    mapping_insert(block_size(block), &fl, &sl);
+    
+    heap_free_bytes += block_size(block);
+    heap_free_count++;
+    fl_free_count[fl]++;
+    
+    memory_block_t* head = free_lists[fl][sl];
+    block->next_free = head;
+    block->prev_free = NULL;
+    if (head) {
+        head->prev_free = block;
+    }
+    free_lists[fl][sl] = block;
+    
+    fl_bitmap |= 1u << fl;
+    sl_bitmap[fl] |= 1u << sl;
+}
+
+static void remove_free_block(memory_block_t* block) {
+    int fl, sl;
+    mapping_insert(block_size(block), &fl, &sl);
+    
+    heap_free_bytes -= block_size(block);
+    heap_free_count--;
+    fl_free_count[fl]--;
+    
+    if (block->prev_free) {
+        block->prev_free->next_free = block->next_free;
+    } else {
+        free_lists[fl][sl] = block->next_free;
+    }
+    if (block->next_free) {
+        block->next_free->prev_free = block->prev_free;
+    }
+    
+    if (!free_lists[fl][sl]) {
+        sl_bitmap[fl] &= ~(1u << sl);
+        if (!sl_bitmap[fl]) {
+            fl_bitmap &= ~(1u << fl);
+        }
+    }
 }
 
 // Find a free block of at least the requested size
 static memory_block_t* find_free_block(size_t size) {
-    memory_block_t* current = heap_start;
+    int fl, sl;
+    mapping_search(size, &fl, &sl);
+    if (fl >= FL_COUNT) {
+        return NULL;
+    }
     
-    while (current) {
-        if (current->is_free && current->size >= size) {
-            return current;
+    uint32_t sl_map = sl_bitmap[fl] & (~0u << sl);
+    if (!sl_map) {
+        // Nothing left in this range: use the next larger non-empty one
+        uint32_t fl_map = (fl + 1 < FL_COUNT) ? fl_bitmap & (~0u << (fl + 1)) : 0;
+        if (!fl_map) {
+            return NULL;
         }
-        current = current->next;
+        fl = __builtin_ctz(fl_map);
+        sl_map = sl_bitmap[fl];
     }
     
-    return NULL;
+    return free_lists[fl][__builtin_ctz(sl_map)];
 }
 
-// Split a block if it's larger than needed
+// Take a free block out of its list and mark it used
+static void use_block(memory_block_t* block) {
+    remove_free_block(block);
+    block->size &= ~(size_t)BLOCK_FREE;
+    block_next(block)->size &= ~(size_t)BLOCK_PREV_FREE;
+}
+
+// Split a used block if it's larger than needed, freeing the remainder
 static void split_block(memory_block_t* block, size_t size) {
-    if (block->size <= size + sizeof(memory_block_t)) {
+    if (block_size(block) < size + sizeof(memory_block_t)) {
         return; // Not worth splitting
     }
     
-    memory_block_t* new_block = (memory_block_t*)((uint8_t*)block + sizeof(memory_block_t) + size);
-    new_block->size = block->size - size - sizeof(memory_block_t);
-    new_block->is_free = 1;
-    new_block->next = block->next;
-    new_block->prev = block;
+    memory_block_t* rest = (memory_block_t*)((uint8_t*)block_to_ptr(block) + size);
+    rest->prev_phys = block;
+    rest->size = block_size(block) - size - BLOCK_OVERHEAD;
+    block->size = size | (block->size & BLOCK_FLAGS);
+    block_next(rest)->prev_phys = rest;
     
-    if (block->next) {
-        block->next->prev = new_block;
-    } else {
-        heap_end = new_block;
-    }
-    
-    block->next = new_block;
-    block->size = size;
+    heap_free_block(rest);
 }
 
-// Merge adjacent free blocks
-static void merge_free_blocks(memory_block_t* block) {
-    // Merge with next block if it's free
-    if (block->next && block->next->is_free) {
-        block->size += sizeof(memory_block_t) + block->next->size;
-        if (block->next->next) {
-            block->next->next->prev = block;
-        } else {
-            heap_end = block;
-        }
-        block->next = block->next->next;
+// Mark a block free, merge it with free physical neighbours and file it
+static void heap_free_block(memory_block_t* block) {
+    memory_block_t* next = block_next(block);
+    if (block_is_free(next)) {
+        remove_free_block(next);
+        block->size += BLOCK_OVERHEAD + block_size(next);
     }
     
-    // Merge with previous block if it's free
-    if (block->prev && block->prev->is_free) {
-        block->prev->size += sizeof(memory_block_t) + block->size;
-        if (block->next) {
-            block->next->prev = block->prev;
-        } else {
-            heap_end = block->prev;
-        }
-        block->prev->next = block->next;
+    if (block->size & BLOCK_PREV_FREE) {
+        memory_block_t* prev = block->prev_phys;
+        remove_free_block(prev);
+        prev->size += BLOCK_OVERHEAD + block_size(block);
+        block = prev;
     }
+    
+    block->size |= BLOCK_FREE;
+    next = block_next(block);
+    next->prev_phys = block;
+    next->size |= BLOCK_PREV_FREE;
+    insert_free_block(block);
 }
 
-void* kmalloc(size_t size) {
-    if (!heap_initialized || size == 0) {
+static size_t adjust_request_size(size_t size) {
+    size = (size + BLOCK_ALIGN - 1) & ~(size_t)(BLOCK_ALIGN - 1);
+    return size < BLOCK_MIN_SIZE ? BLOCK_MIN_SIZE : size;
+}
+
+// Allocate from the block heap (good fit)
+static void* heap_alloc(size_t size) {
+    // Rounding a huge request up would wrap around to a small size
+    if (size > HEAP_ALLOC_MAX) {
         return NULL;
     }
-    
-    // Align to 4-byte boundary
-    size = (size + 3) & ~3;
+    size = adjust_request_size(size);
     
     memory_block_t* block = find_free_block(size);
     if (!block) {
         return NULL; // Out of memory
     }
     
+    use_block(block);
     split_block(block, size);
-    block->is_free = 0;
     
-    return (uint8_t*)block + sizeof(memory_block_t);
+    heap_used_bytes += block_size(block);
+    heap_used_count++;
+    return block_to_ptr(block);
 }
 
-void kfree(void* ptr) {
-    if (!ptr || !heap_initialized) {
-        return;
+// Allocate from the block heap with the returned pointer aligned to 'align'
+// (a power of two). Any leading gap is split off as its own free block.
+static void* heap_alloc_aligned(size_t size, size_t align) {
+    if (size > HEAP_ALLOC_MAX || align > HEAP_ALLOC_MAX) {
+        return NULL;
+    }
+    size = adjust_request_size(size);
+    
+    // Over-allocate so that an aligned start with a usable gap always fits
+    memory_block_t* block = find_free_block(size + align + sizeof(memory_block_t));
+    if (!block) {
+        return NULL;
+    }
+    use_block(block);
+    
+    uintptr_t data = (uintptr_t)block_to_ptr(block);
+    uintptr_t aligned = (data + align - 1) & ~(uintptr_t)(align - 1);
+    uintptr_t gap = aligned - data;
+    
+    // A leading gap must be large enough to hold a free block
+    if (gap != 0 && gap < sizeof(memory_block_t)) {
+        aligned += align;
+        gap += align;
     }
     
-    memory_block_t* block = (memory_block_t*)((uint8_t*)ptr - sizeof(memory_block_t));
+    if (gap != 0) {
+        memory_block_t* lead = block;
+        block = block_from_ptr((void*)aligned);
+        block->prev_phys = lead;
+        block->size = block_size(lead) - gap;
+        block_next(block)->prev_phys = block;
+        
+        lead->size = (gap - BLOCK_OVERHEAD) | (lead->size & BLOCK_PREV_FREE);
+        heap_free_block(lead);
+    }
+    
+    split_block(block, size);
+    
+    heap_used_bytes += block_size(block);
+    heap_used_count++;
+    return (void*)aligned;
+}
+
+// Return a block to the heap
+static void heap_free(void* ptr) {
+    memory_block_t* block = block_from_ptr(ptr);
     
     // Validate the block is within our heap
     if ((uint8_t*)block < (uint8_t*)heap_start || 
-        (uint8_t*)block >= (uint8_t*)heap_start + total_heap_size) {
+        (uint8_t*)block >= (uint8_t*)heap_end) {
+        return;
+    }
+    
+    // Ignore double frees
+    if (block_is_free(block)) {
+        return;
+    }
+    
+    heap_used_bytes -= block_size(block);
+    heap_used_count--;
+    heap_free_block(block);
+}
+
+static void slab_init(void) {
+    uint32_t object_size = SLAB_MIN_SIZE;
+    
+    for (int i = 0; i < SLAB_NUM_CLASSES; i++) {
+        slab_class_t* cls = &slab_classes[i];
+        cls->object_size = object_size;
+        
+        // Small classes use one page per slab; larger classes grow the slab
+        // so that each one still holds at least 15 objects.
+        cls->slab_size = PAGE_SIZE;
+        while (cls->slab_size < object_size * 16) {
+            cls->slab_size <<= 1;
+        }
+        
+        cls->partial = NULL;
+        cls->slabs = 0;
+        cls->objects_in_use = 0;
+        cls->objects_total = 0;
+        object_size <<= 1;
+    }
+    
+    memset(slab_page_map, 0, heap_region_size / PAGE_SIZE);
+}
+
+// Map a request size to its size class (or -1 if too large)
+static int slab_class_index(size_t size) {
+    if (size > SLAB_MAX_SIZE) {
+        return -1;
+    }
+    
+    int index = 0;
+    uint32_t class_size = SLAB_MIN_SIZE;
+    while (class_size < size) {
+        class_size <<= 1;
+        index++;
+    }
+    return index;
+}
+
+// Look up the slab owning ptr, or NULL if ptr is not a slab object
+static slab_t* slab_from_ptr(void* ptr) {
+    uintptr_t addr = (uintptr_t)ptr;
+    if (addr < heap_base || addr >= heap_base + heap_region_size) {
+        return NULL;
+    }
+    
+    uint8_t entry = slab_page_map[(addr - heap_base) / PAGE_SIZE];
+    if (entry == 0) {
+        return NULL;
+    }
+    
+    slab_class_t* cls = &slab_classes[entry - 1];
+    slab_t* slab = (slab_t*)(addr & ~(cls->slab_size - 1));
+    if (slab->magic != SLAB_MAGIC) {
+        return NULL;
+    }
+    return slab;
+}
+
+static void slab_mark_pages(slab_t* slab, uint32_t slab_size, uint8_t value) {
+    uint32_t first = ((uintptr_t)slab - heap_base) / PAGE_SIZE;
+    for (uint32_t i = 0; i < slab_size / PAGE_SIZE; i++) {
+        slab_page_map[first + i] = value;
+    }
+}
+
+static void slab_list_remove(slab_class_t* cls, slab_t* slab) {
+    if (slab->prev) {
+        slab->prev->next = slab->next;
+    } else {
+        cls->partial = slab->next;
+    }
+    if (slab->next) {
+        slab->next->prev = slab->prev;
+    }
+    slab->next = NULL;
+    slab->prev = NULL;
+}
+
+static void slab_list_push(slab_class_t* cls, slab_t* slab) {
+    slab->prev = NULL;
+    slab->next = cls->partial;
+    if (cls->partial) {
+        cls->partial->prev = slab;
+    }
+    cls->partial = slab;
+}
+
+// Carve a new slab for a class out of the block heap
+static slab_t* slab_grow(int index) {
+    slab_class_t* cls = &slab_classes[index];
+    
+    slab_t* slab = (slab_t*)heap_alloc_aligned(cls->slab_size, cls->slab_size);
+    if (!slab) {
+        return NULL;
+    }
+    
+    // First object starts at the header rounded up to the object size,
+    // keeping every object naturally aligned
+    uintptr_t offset = (sizeof(slab_t) + cls->object_size - 1) & ~(cls->object_size - 1);
+    
+    slab->magic = SLAB_MAGIC;
+    slab->class_index = (uint16_t)index;
+    slab->in_use = 0;
+    slab->capacity = (uint16_t)((cls->slab_size - offset) / cls->object_size);
+    slab->reserved = 0;
+    slab->free_list = NULL;
+    
+    // Thread the free list so that objects are handed out in address order
+    uint8_t* base = (uint8_t*)slab + offset;
+    for (int i = slab->capacity - 1; i >= 0; i--) {
+        void** object = (void**)(base + i * cls->object_size);
+        *object = slab->free_list;
+        slab->free_list = object;
+    }
+    
+    slab_mark_pages(slab, cls->slab_size, (uint8_t)(index + 1));
+    slab_list_push(cls, slab);
+    
+    cls->slabs++;
+    cls->objects_total += slab->capacity;
+    return slab;
+}
+
+static void* slab_alloc(int index) {
+    slab_class_t* cls = &slab_classes[index];
+    
+    slab_t* slab = cls->partial;
+    if (!slab) {
+        slab = slab_grow(index);
+        if (!slab) {
+            return NULL;
+        }
+    }
+    
+    void** object = (void**)slab->free_list;
+    slab->free_list = *object;
+    slab->in_use++;
+    cls->objects_in_use++;
+    
+    // Full slabs leave the partial list until an object is freed
+    if (!slab->free_list) {
+        slab_list_remove(cls, slab);
+    }
+    
+    return object;
+}
+
+static void slab_free(slab_t* slab, void* ptr) {
+    slab_class_t* cls = &slab_classes[slab->class_index];
+    int was_full = (slab->free_list == NULL);
+    
+    *(void**)ptr = slab->free_list;
+    slab->free_list = ptr;
+    slab->in_use--;
+    cls->objects_in_use--;
+    
+    if (was_full) {
+        slab_list_push(cls, slab);
+    }
+    
+    // Give empty slabs back to the heap, but keep one around per class
+    // so alloc/free ping-pong doesn't repeatedly grow and shrink
+    if (slab->in_use == 0 && (slab->next || slab->prev)) {
+        slab_list_remove(cls, slab);
+        slab_mark_pages(slab, cls->slab_size, 0);
+        slab->magic = 0;
+        cls->slabs--;
+        cls->objects_total -= slab->capacity;
+        heap_free(slab);
+    }
+}
+
+static inline uint32_t profile_hash(const void* ptr) {
+    return (uint32_t)(((uintptr_t)ptr >> 4) * 2654435761u) & (PROFILE_TABLE_SIZE - 1);
+}
+
+static uint32_t profile_site_index(uintptr_t site) {
+    for (uint32_t i = 0; i < profile_site_count; i++) {
+        if (profile_sites[i].site == site) {
+            return i;
+        }
+    }
+    
+    if (profile_site_count < PROFILE_MAX_SITES - 1) {
+        profile_sites[profile_site_count].site = site;
+        return profile_site_count++;
+    }
+    return PROFILE_MAX_SITES - 1;
+}
+
+static void profile_record_alloc(void* ptr, size_t size, uintptr_t site) {
+    // Keep the table at most 3/4 full so probe sequences stay short
+    if (profile_entries >= PROFILE_TABLE_SIZE / 4 * 3) {
+        profile_untracked++;
         return;
     }
     
-    block->is_free = 1;
-    merge_free_blocks(block);
+    uint32_t index = profile_site_index(site);
+    profile_site_t* s = &profile_sites[index];
+    s->allocs++;
+    s->live_count++;
+    s->live_bytes += size;
+    if (s->live_bytes > s->peak_bytes) {
+        s->peak_bytes = s->live_bytes;
+    }
+    
+    uint32_t slot = profile_hash(ptr);
+    while (profile_table[slot].ptr) {
+        slot = (slot + 1) & (PROFILE_TABLE_SIZE - 1);
+    }
+    profile_table[slot].ptr = ptr;
+    profile_table[slot].size = size;
+    profile_table[slot].site = index;
+    profile_entries++;
+}
+
+static void profile_record_free(void* ptr) {
+    uint32_t slot = profile_hash(ptr);
+    while (profile_table[slot].ptr != ptr) {
+        if (!profile_table[slot].ptr) {
+            return; // Allocated before profiling started
+        }
+        slot = (slot + 1) & (PROFILE_TABLE_SIZE - 1);
+    }
+    
+    profile_site_t* s = &profile_sites[profile_table[slot].site];
+    s->live_count--;
+    s->live_bytes -= profile_table[slot].size;
+    profile_entries--;
+    
+    // Backward-shift deletion: pull later entries of the probe run into
+    // the hole so lookups never need tombstones
+    uint32_t hole = slot;
+    uint32_t next = slot;
+    for (;;) {
+        next = (next + 1) & (PROFILE_TABLE_SIZE - 1);
+        if (!profile_table[next].ptr) {
+            break;
+        }
+        uint32_t home = profile_hash(profile_table[next].ptr);
+        if (((next - home) & (PROFILE_TABLE_SIZE - 1)) >=
+            ((next - hole) & (PROFILE_TABLE_SIZE - 1))) {
+            profile_table[hole] = profile_table[next];
+            hole = next;
+        }
+    }
+    profile_table[hole].ptr = NULL;
+}
+
+// The heap is shared by preemptible processes and interrupt-time callers
+// (fork from int 0x80, caches refilling in the fault path), so the free
+// lists, slabs and profile table only change with interrupts disabled.
+static void* kmalloc_tagged(size_t size, uintptr_t site) {
+    if (!heap_initialized || size == 0) {
+        return NULL;
+    }
+    
+    uint32_t eflags = cpu_irq_save();
+    void* ptr = NULL;
+    int index = slab_class_index(size);
+    if (index >= 0) {
+        ptr = slab_alloc(index);
+        // Fall back to the block heap if no slab could be created
+    }
+    if (!ptr) {
+        ptr = heap_alloc(size);
+    }
+    
+    if (ptr && profile_table) {
+        profile_record_alloc(ptr, size, site);
+    }
+    cpu_irq_restore(eflags);
+    return ptr;
+}
+
+void* kmalloc(size_t size) {
+    return kmalloc_tagged(size, (uintptr_t)__builtin_return_address(0));
+}
+
+void kfree(void* ptr) {
+    if (!ptr || !heap_initialized) {
+        return;
+    }
+    
+    uint32_t eflags = cpu_irq_save();
+    if (profile_table) {
+        profile_record_free(ptr);
+    }
+    
+    slab_t* slab = slab_from_ptr(ptr);
+    if (slab) {
+        slab_free(slab, ptr);
+    } else {
+        heap_free(ptr);
+    }
+    cpu_irq_restore(eflags);
 }
 
 void* krealloc(void* ptr, size_t new_size) {
+    uintptr_t site = (uintptr_t)__builtin_return_address(0);
+    
     if (!ptr) {
-        return kmalloc(new_size);
+        return kmalloc_tagged(new_size, site);
     }
     
     if (new_size == 0) {
@@ -136,26 +709,35 @@ void* krealloc(void* ptr, size_t new_size) {
         return NULL;
     }
     
-    memory_block_t* block = (memory_block_t*)((uint8_t*)ptr - sizeof(memory_block_t));
+    size_t old_size;
+    slab_t* slab = slab_from_ptr(ptr);
+    if (slab) {
+        old_size = slab_classes[slab->class_index].object_size;
+    } else {
+        old_size = block_size(block_from_ptr(ptr));
+    }
     
-    if (block->size >= new_size) {
-        return ptr; // Current block is large enough
+    if (old_size >= new_size) {
+        return ptr; // Current allocation is large enough
     }
     
-    void* new_ptr = kmalloc(new_size);
+    void* new_ptr = kmalloc_tagged(new_size, site);
     if (!new_ptr) {
         return NULL;
     }
     
-    memcpy(new_ptr, ptr, block->size < new_size ? block->size : new_size);
+    memcpy(new_ptr, ptr, old_size);
     kfree(ptr);
     
     return new_ptr;
 }
 
 void* kcalloc(size_t num, size_t size) {
+    if (size != 0 && num > (size_t)-1 / size) {
+        return NULL;  // num * size overflows
+    }
     size_t total_size = num * size;
-    void* ptr = kmalloc(total_size);
+    void* ptr = kmalloc_tagged(total_size, (uintptr_t)__builtin_return_address(0));
     
     if (ptr) {
         memset(ptr, 0, total_size);
@@ -164,27 +746,42 @@ void* kcalloc(size_t num, size_t size) {
     return ptr;
 }
 
+// The largest free block is in the highest non-empty free list
+static uint32_t largest_free_block(void) {
+    if (!fl_bitmap) {
+        return 0;
+    }
+    
+    int fl = 31 - __builtin_clz(fl_bitmap);
+    int sl = 31 - __builtin_clz(sl_bitmap[fl]);
+    uint32_t largest = 0;
+    for (memory_block_t* block = free_lists[fl][sl]; block; block = block->next_free) {
+        if (block_size(block) > largest) {
+            largest = block_size(block);
+        }
+    }
+    return largest;
+}
+
 void memory_get_stats(memory_stats_t* stats) {
     if (!stats || !heap_initialized) {
         return;
     }
     
     stats->total_memory = total_heap_size;
-    stats->used_memory = 0;
-    stats->free_memory = 0;
-    stats->allocated_blocks = 0;
-    stats->free_blocks = 0;
+    stats->used_memory = heap_used_bytes;
+    stats->free_memory = heap_free_bytes;
+    stats->allocated_blocks = heap_used_count;
+    stats->free_blocks = heap_free_count;
+    stats->largest_free_block = largest_free_block();
     
-    memory_block_t* current = heap_start;
-    while (current) {
-        if (current->is_free) {
-            stats->free_memory += current->size;
-            stats->free_blocks++;
-        } else {
-            stats->used_memory += current->size;
-            stats->allocated_blocks++;
-        }
-        current = current->next;
+    for (int i = 0; i < SLAB_NUM_CLASSES; i++) {
+        slab_class_stats_t* out = &stats->slab_classes[i];
+        out->object_size = slab_classes[i].object_size;
+        out->slab_size = slab_classes[i].slab_size;
+        out->slabs = slab_classes[i].slabs;
+        out->objects_in_use = slab_classes[i].objects_in_use;
+        out->objects_total = slab_classes[i].objects_total;
     }
 }
 
@@ -202,6 +799,16 @@ void memory_print_stats(void) {
            (stats.free_memory * 100) / stats.total_memory);
     printk("  Allocated blocks: %u\n", stats.allocated_blocks);
     printk("  Free blocks:     %u\n", stats.free_blocks);
+    printk("  Largest free:    %u KB\n", stats.largest_free_block / 1024);
+    
+    printk("\nSlab Classes:\n");
+    printk("  Size   Slabs  In use / Total\n");
+    for (int i = 0; i < SLAB_NUM_CLASSES; i++) {
+        slab_class_stats_t* cls = &stats.slab_classes[i];
+        printk("  %u\t %u\t%u / %u\n",
+               cls->object_size, cls->slabs,
+               cls->objects_in_use, cls->objects_total);
+    }
 }
 
 void memory_dump_heap(void) {
@@ -214,37 +821,239 @@ void memory_dump_heap(void) {
     memory_block_t* current = heap_start;
     int block_num = 0;
     
-    while (current && block_num < 20) { // Limit output
-        printk("  Block %d: addr=0x%x, size=%u, %s\n",
+    while (current != heap_end && block_num < 20) { // Limit output
+        printk("  Block %d: addr=%p, size=%u, %s\n",
                block_num,
-               (uint32_t)current,
-               current->size,
-               current->is_free ? "FREE" : "USED");
-        current = current->next;
+               current,
+               (uint32_t)block_size(current),
+               block_is_free(current) ? "FREE" : "USED");
+        current = block_next(current);
         block_num++;
     }
     
-    if (current) {
+    if (current != heap_end) {
         printk("  ... (more blocks)\n");
     }
 }
 
-uint32_t memory_get_total(void) {
-    // For now, return a fixed amount. Later we can detect from BIOS/UEFI
-    return 64 * 1024 * 1024; // 64MB
+uint32_t memory_get_available(void) {
+    return heap_free_bytes;
 }
 
-uint32_t memory_get_available(void) {
-    memory_stats_t stats;
-    memory_get_stats(&stats);
-    return stats.free_memory;
+// Share of free memory that cannot be handed out as one block (0-100)
+uint32_t memory_get_fragmentation(void) {
+    if (heap_free_bytes == 0) {
+        return 0;
+    }
+    // Scale both down so the multiplication stays within 32 bits (no
+    // 64-bit division in the kernel)
+    uint32_t largest = largest_free_block();
+    uint32_t free = heap_free_bytes;
+    while (free > 0x1000000) {
+        largest >>= 4;
+        free >>= 4;
+    }
+    return 100 - largest * 100 / free;
+}
+
+void memory_print_fragmentation(void) {
+    printk("\nHeap Fragmentation:\n");
+    printk("  Free: %u KB in %u blocks, largest %u KB\n",
+           heap_free_bytes / 1024, heap_free_count, largest_free_block() / 1024);
+    printk("  Fragmentation index: %u%%\n", memory_get_fragmentation());
+    
+    printk("  Free block sizes:\n");
+    for (int fl = 0; fl < FL_COUNT; fl++) {
+        if (!fl_free_count[fl]) {
+            continue;
+        }
+        uint32_t low = fl ? 1u << (fl + FL_INDEX_SHIFT - 1) : 0;
+        uint32_t high = (1u << (fl + FL_INDEX_SHIFT)) - 1;
+        printk("    %u - %u bytes:\t%u\n", low, high, fl_free_count[fl]);
+    }
+}
+
+void memory_profile_enable(int enable) {
+    uint32_t eflags = cpu_irq_save();
+    if (enable && !profile_table) {
+        profile_table = (profile_entry_t*)heap_alloc(PROFILE_TABLE_SIZE * sizeof(profile_entry_t));
+        if (!profile_table) {
+            cpu_irq_restore(eflags);
+            printk_error("Not enough heap for the allocation profiler");
+            return;
+        }
+        memset(profile_table, 0, PROFILE_TABLE_SIZE * sizeof(profile_entry_t));
+        memset(profile_sites, 0, sizeof(profile_sites));
+        profile_site_count = 0;
+        profile_entries = 0;
+        profile_untracked = 0;
+    } else if (!enable && profile_table) {
+        heap_free(profile_table);
+        profile_table = NULL;
+    }
+    cpu_irq_restore(eflags);
+}
+
+int memory_profile_enabled(void) {
+    return profile_table != NULL;
+}
+
+void memory_print_profile(void) {
+    if (!profile_table) {
+        printk("Allocation profiling is off ('heap prof on' to start)\n");
+        return;
+    }
+    
+    printk("\nTop Allocation Sites (by live bytes):\n");
+    printk("  Caller\t\tAllocs\tLive\tLive KB\tPeak KB\n");
+    
+    // Selection of the ten largest sites; the table is small
+    uint8_t shown[PROFILE_MAX_SITES] = {0};
+    for (int n = 0; n < 10; n++) {
+        int best = -1;
+        for (uint32_t i = 0; i < PROFILE_MAX_SITES; i++) {
+            if (!shown[i] && profile_sites[i].allocs &&
+                (best < 0 || profile_sites[i].live_bytes > profile_sites[best].live_bytes)) {
+                best = (int)i;
+            }
+        }
+        if (best < 0) {
+            break;
+        }
+        shown[best] = 1;
+        
+        profile_site_t* s = &profile_sites[best];
+        if (best == PROFILE_MAX_SITES - 1) {
+            printk("  (other)\t");
+        } else {
+            printk("  %p\t", (void*)s->site);
+        }
+        printk("%u\t%u\t%u\t%u\n", s->allocs, s->live_count,
+               s->live_bytes / 1024, s->peak_bytes / 1024);
+    }
+    
+    if (profile_untracked) {
+        printk("  %u allocations not tracked (table full)\n", profile_untracked);
+    }
 }
 
 // Memory utility functions
+// String kernels
+// The destination is aligned first so the bulk of the work is done with
+// rep stosd/movsd. Blocks of MEM_SSE_THRESHOLD bytes or more go through
+// 64-byte SSE2 loops when cpu_init enabled SSE.
+#define MEM_SSE_THRESHOLD   512
+#define MEM_SSE_CHUNK       4096    // Bytes moved per interrupts-off window
+
+typedef uint32_t __attribute__((may_alias)) mem_word_t;
+
+// The kernel does not switch FPU/SSE state between tasks, so a routine
+// using XMM registers must leave them exactly as it found them: the
+// registers are saved to the stack and restored, with interrupts off so
+// that nothing else can run (and use them) in between.
+static inline unsigned long sse_begin(uint8_t* save) {
+    unsigned long flags;
+    __asm__ volatile("pushf\n\tpop %0\n\tcli" : "=r"(flags) : : "memory");
+    __asm__ volatile("movdqu %%xmm0, 0(%0)\n\t"
+                     "movdqu %%xmm1, 16(%0)\n\t"
+                     "movdqu %%xmm2, 32(%0)\n\t"
+                     "movdqu %%xmm3, 48(%0)"
+                     : : "r"(save) : "memory");
+    return flags;
+}
+
+static inline void sse_end(const uint8_t* save, unsigned long flags) {
+    __asm__ volatile("movdqu 0(%0), %%xmm0\n\t"
+                     "movdqu 16(%0), %%xmm1\n\t"
+                     "movdqu 32(%0), %%xmm2\n\t"
+                     "movdqu 48(%0), %%xmm3"
+                     : : "r"(save) : "memory");
+    if (flags & 0x200) {
+        __asm__ volatile("sti" : : : "memory");
+    }
+}
+
+// Fill 16-byte aligned 'dest' with 'size' / 64 blocks of 'pattern'
+static void sse_set_blocks(uint8_t* dest, uint32_t pattern, size_t size) {
+    uint8_t save[64];
+    
+    while (size >= 64) {
+        size_t chunk = size < MEM_SSE_CHUNK ? size & ~(size_t)63 : MEM_SSE_CHUNK;
+        unsigned long flags = sse_begin(save);
+        
+        __asm__ volatile("movd %0, %%xmm0\n\t"
+                         "pshufd $0, %%xmm0, %%xmm0"
+                         : : "r"(pattern));
+        for (size_t i = 0; i < chunk; i += 64) {
+            __asm__ volatile("movdqa %%xmm0, 0(%0)\n\t"
+                             "movdqa %%xmm0, 16(%0)\n\t"
+                             "movdqa %%xmm0, 32(%0)\n\t"
+                             "movdqa %%xmm0, 48(%0)"
+                             : : "r"(dest + i) : "memory");
+        }
+        
+        sse_end(save, flags);
+        dest += chunk;
+        size -= chunk;
+    }
+}
+
+// Copy 'size' / 64 blocks to 16-byte aligned 'dest' from any 'src'
+static void sse_copy_blocks(uint8_t* dest, const uint8_t* src, size_t size) {
+    uint8_t save[64];
+    
+    while (size >= 64) {
+        size_t chunk = size < MEM_SSE_CHUNK ? size & ~(size_t)63 : MEM_SSE_CHUNK;
+        unsigned long flags = sse_begin(save);
+        
+        for (size_t i = 0; i < chunk; i += 64) {
+            __asm__ volatile("movdqu 0(%1), %%xmm0\n\t"
+                             "movdqu 16(%1), %%xmm1\n\t"
+                             "movdqu 32(%1), %%xmm2\n\t"
+                             "movdqu 48(%1), %%xmm3\n\t"
+                             "movdqa %%xmm0, 0(%0)\n\t"
+                             "movdqa %%xmm1, 16(%0)\n\t"
+                             "movdqa %%xmm2, 32(%0)\n\t"
+                             "movdqa %%xmm3, 48(%0)"
+                             : : "r"(dest + i), "r"(src + i) : "memory");
+        }
+        
+        sse_end(save, flags);
+        dest += chunk;
+        src += chunk;
+        size -= chunk;
+    }
+}
+
 void* memset(void* ptr, int value, size_t size) {
     uint8_t* p = (uint8_t*)ptr;
+    uint8_t byte = (uint8_t)value;
+    uint32_t pattern = byte * 0x01010101u;
+    
+    if (size >= MEM_SSE_THRESHOLD && cpu_has(CPU_FEATURE_SSE_ENABLED)) {
+        while ((uintptr_t)p & 15) {
+            *p++ = byte;
+            size--;
+        }
+        sse_set_blocks(p, pattern, size);
+        p += size & ~(size_t)63;
+        size &= 63;
+    }
+    
+    while (size && ((uintptr_t)p & 3)) {
+        *p++ = byte;
+        size--;
+    }
+    
+    size_t words = size >> 2;
+    __asm__ volatile("rep stosl"
+                     : "+D"(p), "+c"(words)
+                     : "a"(pattern)
+                     : "memory");
+    
+    size &= 3;
     while (size--) {
-        *p++ = (uint8_t)value;
+        *p++ = byte;
     }
     return ptr;
 }
@@ -253,6 +1062,29 @@ void* memcpy(void* dest, const void* src, size_t size) {
     uint8_t* d = (uint8_t*)dest;
     const uint8_t* s = (const uint8_t*)src;
     
+    if (size >= MEM_SSE_THRESHOLD && cpu_has(CPU_FEATURE_SSE_ENABLED)) {
+        while ((uintptr_t)d & 15) {
+            *d++ = *s++;
+            size--;
+        }
+        sse_copy_blocks(d, s, size);
+        d += size & ~(size_t)63;
+        s += size & ~(size_t)63;
+        size &= 63;
+    }
+    
+    while (size && ((uintptr_t)d & 3)) {
+        *d++ = *s++;
+        size--;
+    }
+    
+    size_t words = size >> 2;
+    __asm__ volatile("rep movsl"
+                     : "+D"(d), "+S"(s), "+c"(words)
+                     :
+                     : "memory");
+    
+    size &= 3;
     while (size--) {
         *d++ = *s++;
     }
@@ -264,6 +1096,24 @@ int memcmp(const void* ptr1, const void* ptr2, size_t size) {
     const uint8_t* p1 = (const uint8_t*)ptr1;
     const uint8_t* p2 = (const uint8_t*)ptr2;
     
+    // Compare a word at a time when both sides can be aligned together;
+    // a differing word is resolved byte by byte below
+    if (((uintptr_t)p1 & 3) == ((uintptr_t)p2 & 3)) {
+        while (size && ((uintptr_t)p1 & 3)) {
+            if (*p1 != *p2) {
+                return (*p1 < *p2) ? -1 : 1;
+            }
+            p1++;
+            p2++;
+            size--;
+        }
+        while (size >= 4 && *(const mem_word_t*)p1 == *(const mem_word_t*)p2) {
+            p1 += 4;
+            p2 += 4;
+            size -= 4;
+        }
+    }
+    
     while (size--) {
         if (*p1 != *p2) {
             return (*p1 < *p2) ? -1 : 1;
@@ -273,4 +1123,4 @@ int memcmp(const void* ptr1, const void* ptr2, size_t size) {
     }
     
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,111 @@
+// multiboot.c - Multiboot boot information parsing
+// Copies the usable RAM regions out of the bootloader's memory map so that
+// the heap and frame allocator can be sized from the memory actually present.
+#include <multiboot.h>
+#include <pmm.h>
+#include <memory.h>
+#include <printk.h>
+#include <stdint.h>
+#include <stddef.h>
+
+static void add_region(boot_memory_map_t* map, uint64_t base, uint64_t length) {
+    uint64_t end = base + length;
+
+    // Ignore memory the kernel cannot address directly
+    if (base >= BOOT_MEMORY_LIMIT) {
+        return;
+    }
+    if (end > BOOT_MEMORY_LIMIT) {
+        end = BOOT_MEMORY_LIMIT;
+    }
+    if (end <= base) {
+        return;
+    }
+
+    if (map->region_count >= BOOT_MAX_REGIONS) {
+        printk_warn("Memory map has more than %d regions, ignoring the rest",
+                    BOOT_MAX_REGIONS);
+        return;
+    }
+
+    boot_region_t* region = &map->regions[map->region_count++];
+    region->base = (uint32_t)base;
+    region->length = (uint32_t)(end - base);
+
+    map->usable_memory += region->length;
+    if ((uint32_t)end > map->memory_end) {
+        map->memory_end = (uint32_t)end;
+    }
+}
+
+void multiboot_parse(uint32_t magic, const multiboot_info_t* info,
+                     boot_memory_map_t* map) {
+    map->region_count = 0;
+    map->memory_end = 0;
+    map->usable_memory = 0;
+
+    printk_info("Reading Multiboot memory information");
+
+    if (magic != MULTIBOOT_BOOTLOADER_MAGIC || !info) {
+        printk_warn("Not booted by a Multiboot loader (magic 0x%x)", magic);
+    } else if (info->flags & MULTIBOOT_INFO_MEM_MAP) {
+        uint32_t addr = info->mmap_addr;
+        uint32_t end = info->mmap_addr + info->mmap_length;
+
+        while (addr < end) {
+            const multiboot_mmap_entry_t* entry = phys_to_virt(addr);
+
+            if ((entry->addr >> 32) == 0) {
+                printk("  0x%x: %u KB %s\n",
+                       (uint32_t)entry->addr, (uint32_t)(entry->len >> 10),
+                       entry->type == MULTIBOOT_MEMORY_AVAILABLE ? "usable" : "reserved");
+            }
+
+            if (entry->type == MULTIBOOT_MEMORY_AVAILABLE) {
+                add_region(map, entry->addr, entry->len);
+            }
+            addr += entry->size + sizeof(entry->size);
+        }
+    } else if (info->flags & MULTIBOOT_INFO_MEMORY) {
+        // No map: conventional memory plus one region above 1MB
+        add_region(map, 0, (uint64_t)info->mem_lower * 1024);
+        add_region(map, 0x100000, (uint64_t)info->mem_upper * 1024);
+    }
+
+    if (map->region_count == 0) {
+        printk_warn("No memory information, assuming %u MB",
+                    PMM_DEFAULT_MEMORY_END / (1024 * 1024));
+        add_region(map, 0x100000, PMM_DEFAULT_MEMORY_END - 0x100000);
+    }
+
+    printk("  Usable memory: %u KB in %u regions, top at 0x%x\n",
+           map->usable_memory / 1024, map->region_count, map->memory_end);
+}
+
+int multiboot_has_option(uint32_t magic, const multiboot_info_t* info,
+                         const char* option) {
+    if (magic != MULTIBOOT_BOOTLOADER_MAGIC || !info ||
+        !(info->flags & MULTIBOOT_INFO_CMDLINE) || !info->cmdline) {
+        return 0;
+    }
+
+    const char* word = phys_to_virt(info->cmdline);
+    while (*word) {
+        while (*word == ' ') {
+            word++;
+        }
+
+        size_t i = 0;
+        while (option[i] && word[i] == option[i]) {
+            i++;
+        }
+        if (!option[i] && (word[i] == ' ' || word[i] == '\0')) {
+            return 1;
+        }
+
+        while (*word && *word != ' ') {
+            word++;
+        }
+    }
+    return 0;
+}
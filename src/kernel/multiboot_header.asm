@@ -4,7 +4,9 @@
 SECTION .multiboot
 ALIGN 4
 MB_MAGIC    equ 0x1BADB002
-MB_FLAGS    equ 0x00000000 ; no extra sections requested yet
+MB_ALIGN    equ 1 << 0     ; page-align loaded modules
+MB_MEMINFO  equ 1 << 1     ; provide mem_lower/mem_upper and the memory map
+MB_FLAGS    equ MB_ALIGN | MB_MEMINFO
 MB_CHECKSUM equ -(MB_MAGIC + MB_FLAGS)
 
 dd MB_MAGIC
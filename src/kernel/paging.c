@@ -1,53 +1,186 @@
 // paging.c - Virtual Memory Management Implementation
 #include <paging.h>
 #include <memory.h>
+#include <pmm.h>
+#include <kmem_cache.h>
+#include <tss.h>
+#include <cpu.h>
+#include <process.h>
+#include <vma.h>
+#include <context.h>
 #include <printk.h>
 #include <stdint.h>
 #include <stddef.h>
 
-// Kernel page directory (global)
+// Kernel page directory (global). It is built before the heap exists, so it
+// is static rather than taken from the directory cache.
+static page_directory_t kernel_page_directory;
 static page_directory_t* kernel_directory = NULL;
 static page_directory_t* current_directory = NULL;
+static int paging_enabled = 0;
+static int large_pages = 0;     // CR4.PSE set: PDEs may map 4MB directly
+
+// Page tables and directories are frame-backed, zero-constructed objects.
+// They are returned zeroed, so recycling one needs no clearing.
+static kmem_cache_t* page_table_cache = NULL;
+static kmem_cache_t* page_directory_cache = NULL;
+
+// Page tables needed before the frame allocator exists are taken from the
+// memory right after the kernel image, which the boot page tables map
+static uint32_t early_table_next = 0;
+
+// End of the kernel image (from linker.ld)
+extern uint8_t __kernel_end[];
 
 // Assembly helper to load page directory (defined at end of file)
-extern void paging_load_directory(uint32_t* page_directory_physical);
-extern void paging_enable_hw(void);
+extern void paging_load_directory(uint32_t page_directory_physical);
 
-void paging_init(void) {
-    printk_info("Initializing Virtual Memory (Paging)");
+static paging_stats_t stats;
+
+// Translation cache for kernel-side lookups, direct mapped by directory and
+// virtual page. An entry with dir == NULL is empty.
+typedef struct {
+    page_directory_t* dir;
+    uint32_t page;              // Virtual page address
+    uint32_t frame;             // Physical address it maps to
+} paging_xlate_t;
+
+static paging_xlate_t xlate_cache[PAGING_XLATE_ENTRIES];
+
+static inline paging_xlate_t* paging_xlate_slot(page_directory_t* dir, uint32_t page) {
+    uint32_t hash = (page >> 12) ^ ((uint32_t)(uintptr_t)dir >> 12);
+    return &xlate_cache[hash & (PAGING_XLATE_ENTRIES - 1)];
+}
+
+// Forget cached translations of [start, end) in dir. Kernel-half mappings
+// are shared, so for them the entries of every directory go.
+static void paging_xlate_drop(page_directory_t* dir, uint32_t start, uint32_t end) {
+    int shared = start >= KERNEL_VIRTUAL_BASE;
+    for (uint32_t i = 0; i < PAGING_XLATE_ENTRIES; i++) {
+        paging_xlate_t* slot = &xlate_cache[i];
+        if (slot->dir && (shared || slot->dir == dir) &&
+            slot->page >= start && slot->page < end) {
+            slot->dir = NULL;
+        }
+    }
+}
+
+static inline void paging_invlpg(uint32_t virtual_addr) {
+    __asm__ volatile("invlpg (%0)" : : "r"(virtual_addr) : "memory");
+    stats.invlpg++;
+}
+
+static void paging_set_cr3(uint32_t page_directory_physical) {
+    paging_load_directory(page_directory_physical);
+    stats.cr3_loads++;
+}
+
+static page_table_t* paging_get_table(page_directory_t* dir, uint32_t virtual_addr,
+                                      uint32_t flags);
+static int paging_is_loaded(page_directory_t* dir);
+
+// Zeroed page table for the kernel half, allocated before the frame
+// allocator exists
+static page_table_t* paging_early_table(void) {
+    if (early_table_next + PAGE_SIZE > KERNEL_BOOT_MAP_END) {
+        printk_error("Early page tables overflow the boot mapping!");
+        return NULL;
+    }
     
-    // Allocate kernel page directory
-    kernel_directory = (page_directory_t*)kmalloc(sizeof(page_directory_t));
-    if (!kernel_directory) {
-        printk_error("Failed to allocate kernel page directory!");
-        return;
+    page_table_t* table = (page_table_t*)phys_to_virt(early_table_next);
+    early_table_next += PAGE_SIZE;
+    memset(table, 0, sizeof(page_table_t));
+    return table;
+}
+
+// Kernel-half page table covering virtual_addr, created if necessary
+static page_table_t* paging_early_get_table(uint32_t virtual_addr) {
+    page_directory_entry_t* pde = &kernel_directory->entries[paging_directory_index(virtual_addr)];
+    if (paging_is_present(*pde)) {
+        return (page_table_t*)phys_to_virt(paging_get_address(*pde));
     }
     
-    // Clear page directory
-    for (int i = 0; i < PAGE_ENTRIES; i++) {
-        kernel_directory->entries[i] = 0;
+    page_table_t* table = paging_early_table();
+    if (table) {
+        *pde = paging_create_pde(virt_to_phys(table), PAGE_PRESENT | PAGE_WRITE);
     }
+    return table;
+}
+
+// Map physical [start, end) at KERNEL_VIRTUAL_BASE + physical, using one 4MB
+// PDE for every aligned 4MB stretch when possible
+static void paging_map_direct(uint32_t start, uint32_t end, uint32_t flags) {
+    start &= ~(PAGE_SIZE - 1);
+    end = PAGE_ALIGN(end);
     
-    printk("  Kernel page directory allocated at: %p\n", kernel_directory);
+    uint32_t addr = start;
+    while (addr < end) {
+        uint32_t virtual_addr = addr + KERNEL_VIRTUAL_BASE;
+        page_directory_entry_t* pde = &kernel_directory->entries[paging_directory_index(virtual_addr)];
+        if (large_pages && (addr & (PAGE_SIZE_LARGE - 1)) == 0 &&
+            end - addr >= PAGE_SIZE_LARGE && !paging_is_present(*pde)) {
+            *pde = paging_create_pde(addr, PAGE_PRESENT | PAGE_SIZE_4MB | flags);
+            addr += PAGE_SIZE_LARGE;
+            continue;
+        }
+        
+        page_table_t* table = paging_early_get_table(virtual_addr);
+        if (!table) {
+            return;
+        }
+        table->entries[paging_table_index(virtual_addr)] =
+            paging_create_pte(addr, PAGE_PRESENT | flags);
+        addr += PAGE_SIZE;
+    }
+}
+
+uint32_t paging_init(uint32_t memory_end) {
+    printk_info("Initializing Virtual Memory (Paging)");
+    
+    kernel_directory = &kernel_page_directory;
+    early_table_next = PAGE_ALIGN(virt_to_phys(__kernel_end));
+    printk("  Kernel page directory at: %p\n", kernel_directory);
+    
+    // Map the kernel half with 4MB pages when possible
+    if (cpu_has(CPU_FEATURE_PSE)) {
+        cpu_write_cr4(cpu_read_cr4() | CR4_PSE);
+        large_pages = 1;
+        printk("  Using 4MB pages (PSE) for the kernel mapping\n");
+    }
     
-    // Identity map the first 16MB (0x00000000 - 0x01000000)
-    // This covers:
-    //   - Kernel code and data (0x00000000 - 0x00400000)
-    //   - User space for processes (0x00400000 - 0x01000000)
-    printk("  Identity mapping first 16MB (kernel + user space)...\n");
-    paging_identity_map(kernel_directory, 0x00000000, 0x01000000, 
-                       PAGE_PRESENT | PAGE_WRITE | PAGE_USER);
+    // Map all RAM (at least 16MB) at KERNEL_VIRTUAL_BASE: the kernel image,
+    // heap and frame table, and every frame the kernel hands out
+    uint32_t direct_end = memory_end;
+    if (direct_end < 0x01000000) {
+        direct_end = 0x01000000;
+    }
+    printk("  Mapping first %u MB at 0x%x...\n",
+           direct_end / (1024 * 1024), KERNEL_VIRTUAL_BASE);
+    paging_map_direct(0, direct_end, PAGE_WRITE | PAGE_GLOBAL);
     
-    // Identity map VGA text buffer (0xB8000 - 0xB9000)
-    printk("  Mapping VGA text buffer (0xB8000)...\n");
-    paging_map_page(kernel_directory, 0xB8000, 0xB8000, 
-                   PAGE_PRESENT | PAGE_WRITE);
+    // Map the directory into itself: with it loaded, the page tables of the
+    // current address space appear at PAGE_TABLES_VIRT
+    kernel_directory->entries[PAGE_RECURSIVE_SLOT] =
+        paging_create_pde(virt_to_phys(kernel_directory), PAGE_PRESENT | PAGE_WRITE);
     
-    // Set current directory
+    // Create the page table for the kernel stack region now. Kernel-half
+    // PDEs never change after this point, which is what lets every address
+    // space share them by copying the entries once.
+    for (uint32_t addr = KERNEL_STACK_REGION; addr < KERNEL_STACK_REGION_END;
+         addr += PAGE_ENTRIES * PAGE_SIZE) {
+        paging_early_get_table(addr);
+    }
+    
+    // Leave the boot page tables; the low identity mapping goes with them
+    paging_set_cr3(virt_to_phys(kernel_directory));
     current_directory = kernel_directory;
+    paging_enabled = 1;
     
-    printk("  [OK] Page tables configured\n");
-    printk("  [OK] Identity mapping complete\n");
+    printk("  [OK] Page tables configured (%u KB of early page tables)\n",
+           (early_table_next - PAGE_ALIGN(virt_to_phys(__kernel_end))) / 1024);
+    printk("  [OK] Kernel half mapped, user space 0x%x - 0x%x\n",
+           USER_SPACE_START, USER_SPACE_END);
+    return early_table_next;
 }
 
 void paging_enable(void) {
@@ -56,103 +189,429 @@ void paging_enable(void) {
         return;
     }
     
-    printk_info("Enabling hardware paging...");
+    printk_info("Enabling paging features...");
+    
+    // Page tables and directories created from now on come from the caches
+    page_table_cache = kmem_cache_create("page_table", sizeof(page_table_t),
+                                         kmem_ctor_zero, KMEM_CACHE_FRAMES);
+    page_directory_cache = kmem_cache_create("page_dir", sizeof(page_directory_t),
+                                             kmem_ctor_zero, KMEM_CACHE_FRAMES);
     
-    // Load page directory address into CR3
-    uint32_t pd_physical = (uint32_t)kernel_directory;
-    printk("  Loading page directory (CR3 = 0x%08X)\n", pd_physical);
-    paging_load_directory((uint32_t*)pd_physical);
+    // Let the double fault task run in the same address space
+    tss_set_double_fault_cr3(virt_to_phys(kernel_directory));
     
-    // Enable paging by setting bit 31 in CR0
-    paging_enable_hw();
+    // Make read-only pages read-only for the kernel too, so kernel writes
+    // into user buffers also break copy-on-write sharing
+    cpu_write_cr0(cpu_read_cr0() | CR0_WP);
+    
+    // Kernel mappings are marked PAGE_GLOBAL (ignored until CR4.PGE is set)
+    // so their TLB entries survive the CR3 reload of every address-space
+    // switch. PGE is turned on only once the boot page tables are gone.
+    if (cpu_has(CPU_FEATURE_PGE)) {
+        cpu_write_cr4(cpu_read_cr4() | CR4_PGE);
+        printk("  [OK] Global pages enabled for kernel mappings\n");
+    }
     
     printk("  [OK] Paging enabled! Virtual memory active.\n");
 }
 
-void paging_identity_map(page_directory_t* dir, uint32_t start, 
-                         uint32_t end, uint32_t flags) {
-    // Align addresses to page boundaries
-    start = start & 0xFFFFF000;
-    end = PAGE_ALIGN(end);
+// Replace a 4MB mapping with a page table mapping the same frames, so that
+// single pages inside it can be changed
+static page_table_t* paging_split_large_page(page_directory_t* dir,
+                                             page_directory_entry_t* pde,
+                                             uint32_t virtual_addr) {
+    page_table_t* page_table = (page_table_t*)kmem_cache_alloc(page_table_cache);
+    if (!page_table) {
+        printk_error("Failed to allocate page table!");
+        return NULL;
+    }
     
-    printk("    Mapping 0x%08X -> 0x%08X (identity)\n", start, end);
+    uint32_t base = *pde & PAGE_LARGE_MASK;
+    uint32_t flags = paging_get_flags(*pde) & ~PAGE_SIZE_4MB;
+    for (uint32_t i = 0; i < PAGE_ENTRIES; i++) {
+        page_table->entries[i] = paging_create_pte(base + i * PAGE_SIZE, flags);
+    }
     
-    // Map each page in the range
-    for (uint32_t addr = start; addr < end; addr += PAGE_SIZE) {
-        paging_map_page(dir, addr, addr, flags);
+    *pde = paging_create_pde(virt_to_phys(page_table), flags | PAGE_PRESENT | PAGE_WRITE);
+    
+    // The TLB may still hold the large translation, which can be global so
+    // reloading CR3 would not drop it, and the recursive window page that
+    // showed the large PDE as a PTE
+    if (paging_is_loaded(dir)) {
+        uint32_t large_page = virtual_addr & PAGE_LARGE_MASK;
+        paging_invlpg(large_page);
+        paging_invlpg((uint32_t)paging_recursive_table(large_page));
     }
+    return page_table;
 }
 
-void paging_map_page(page_directory_t* dir, uint32_t virtual_addr, 
-                     uint32_t physical_addr, uint32_t flags) {
-    // Get page directory and table indices
-    uint32_t dir_index = paging_directory_index(virtual_addr);
-    uint32_t table_index = paging_table_index(virtual_addr);
+int paging_is_enabled(void) {
+    return paging_enabled;
+}
+
+int paging_has_large_pages(void) {
+    return large_pages;
+}
+
+// Whether dir is the address space loaded in CR3. Its page tables are then
+// reachable through the recursive slot without touching physical memory.
+static int paging_is_loaded(page_directory_t* dir) {
+    if (!paging_enabled) {
+        return 0;
+    }
     
-    // Check if page table exists
-    page_directory_entry_t* pde = &dir->entries[dir_index];
-    page_table_t* page_table;
+    uint32_t cr3;
+    __asm__ volatile("mov %%cr3, %0" : "=r"(cr3));
+    return cr3 == virt_to_phys(dir);
+}
+
+// Page directory entry covering virtual_addr
+static page_directory_entry_t* paging_pde(page_directory_t* dir, uint32_t virtual_addr,
+                                          int loaded) {
+    if (loaded) {
+        return paging_recursive_pde(virtual_addr);
+    }
+    return &dir->entries[paging_directory_index(virtual_addr)];
+}
+
+// Page table behind a present, non-4MB PDE
+static page_table_t* paging_pde_table(page_directory_entry_t pde, uint32_t virtual_addr,
+                                      int loaded) {
+    if (loaded) {
+        return paging_recursive_table(virtual_addr);
+    }
+    return (page_table_t*)phys_to_virt(paging_get_address(pde));
+}
+
+// Get the page table covering virtual_addr, creating it if necessary
+static page_table_t* paging_get_table(page_directory_t* dir, uint32_t virtual_addr,
+                                      uint32_t flags) {
+    int loaded = paging_is_loaded(dir);
+    page_directory_entry_t* pde = paging_pde(dir, virtual_addr, loaded);
+    
+    if (paging_is_present(*pde)) {
+        if ((*pde & PAGE_SIZE_4MB) && !paging_split_large_page(dir, pde, virtual_addr)) {
+            return NULL;
+        }
+        return paging_pde_table(*pde, virtual_addr, loaded);
+    }
+    
+    // Allocate new (already zeroed) page table
+    page_table_t* page_table = (page_table_t*)kmem_cache_alloc(page_table_cache);
+    if (!page_table) {
+        printk_error("Failed to allocate page table!");
+        return NULL;
+    }
+    
+    // Add page table to directory
+    *pde = paging_create_pde(virt_to_phys(page_table), PAGE_PRESENT | PAGE_WRITE | flags);
+    if (loaded) {
+        page_table = paging_recursive_table(virtual_addr);
+        paging_invlpg((uint32_t)page_table);
+    }
+    return page_table;
+}
+
+// Flush every TLB entry. Reloading CR3 keeps global entries, so when the
+// range is in the (global) kernel half CR4.PGE is toggled instead.
+static void paging_flush_tlb(int global) {
+    stats.tlb_flushes++;
+    
+    uint32_t cr4 = cpu_read_cr4();
+    if (global && (cr4 & CR4_PGE)) {
+        cpu_write_cr4(cr4 & ~CR4_PGE);
+        cpu_write_cr4(cr4);
+        return;
+    }
+    
+    uint32_t cr3;
+    __asm__ volatile("mov %%cr3, %0" : "=r"(cr3));
+    paging_set_cr3(cr3);
+}
+
+// Drop stale translations for [start, end) after its entries in dir changed
+static void paging_invalidate_range(page_directory_t* dir, uint32_t start, uint32_t end) {
+    // Kernel-half mappings are cached in every address space; user ones
+    // only while dir is loaded (switching CR3 drops them)
+    int kernel = start >= KERNEL_VIRTUAL_BASE;
+    if (!kernel && !paging_is_loaded(dir)) {
+        return;
+    }
+    
+    if ((end - start) / PAGE_SIZE > PAGING_INVLPG_MAX) {
+        paging_flush_tlb(kernel);
+        return;
+    }
+    for (uint32_t addr = start; addr < end; addr += PAGE_SIZE) {
+        paging_invlpg(addr);
+    }
+}
+
+int paging_map_range(page_directory_t* dir, uint32_t virtual_addr,
+                     uint32_t physical_addr, uint32_t size, uint32_t flags) {
+    uint32_t start = virtual_addr & ~(PAGE_SIZE - 1);
+    uint32_t end = PAGE_ALIGN(virtual_addr + size);
+    uint32_t frame = physical_addr & ~(PAGE_SIZE - 1);
+    int remapped = 0;
     
-    if (!paging_is_present(*pde)) {
-        // Allocate new page table
-        page_table = (page_table_t*)kmalloc(sizeof(page_table_t));
+    // One page table lookup per 4MB, then a run of entries
+    uint32_t addr = start;
+    while (addr < end) {
+        page_table_t* page_table = paging_get_table(dir, addr, flags);
         if (!page_table) {
-            printk_error("Failed to allocate page table!");
-            return;
+            return -1;
+        }
+        
+        uint32_t index = paging_table_index(addr);
+        uint32_t last = index + (end - addr) / PAGE_SIZE;
+        if (last > PAGE_ENTRIES) {
+            last = PAGE_ENTRIES;
+        }
+        for (; index < last; index++) {
+            remapped |= paging_is_present(page_table->entries[index]);
+            page_table->entries[index] = paging_create_pte(frame, PAGE_PRESENT | flags);
+            frame += PAGE_SIZE;
+            addr += PAGE_SIZE;
+        }
+    }
+    
+    // Filling not-present entries needs no invalidation; replacing does
+    if (remapped) {
+        paging_xlate_drop(dir, start, end);
+        paging_invalidate_range(dir, start, end);
+    }
+    return 0;
+}
+
+uint32_t paging_unmap_range(page_directory_t* dir, uint32_t virtual_addr, uint32_t size,
+                            void (*release)(uint32_t frame)) {
+    int loaded = paging_is_loaded(dir);
+    uint32_t start = virtual_addr & ~(PAGE_SIZE - 1);
+    uint32_t end = PAGE_ALIGN(virtual_addr + size);
+    uint32_t unmapped = 0;
+    
+    uint32_t addr = start;
+    while (addr < end) {
+        // Part of the range covered by this page directory entry
+        uint32_t table_end = (addr & PAGE_LARGE_MASK) + PAGE_SIZE_LARGE;
+        if (table_end == 0 || table_end > end) {
+            table_end = end;
         }
         
-        // Clear page table
-        for (int i = 0; i < PAGE_ENTRIES; i++) {
-            page_table->entries[i] = 0;
+        page_directory_entry_t* pde = paging_pde(dir, addr, loaded);
+        if (!paging_is_present(*pde) ||
+            ((*pde & PAGE_SIZE_4MB) && !paging_split_large_page(dir, pde, addr))) {
+            addr = table_end;
+            continue;
         }
         
-        // Add page table to directory
-        *pde = paging_create_pde((uint32_t)page_table, PAGE_PRESENT | PAGE_WRITE | flags);
-    } else {
-        // Get existing page table
-        page_table = (page_table_t*)paging_get_address(*pde);
+        page_table_t* page_table = paging_pde_table(*pde, addr, loaded);
+        for (; addr < table_end; addr += PAGE_SIZE) {
+            page_table_entry_t* pte = &page_table->entries[paging_table_index(addr)];
+            if (!paging_is_present(*pte)) {
+                continue;
+            }
+            if (release) {
+                release(paging_get_address(*pte));
+            }
+            *pte = 0;
+            unmapped++;
+        }
     }
     
-    // Set page table entry
-    page_table->entries[table_index] = paging_create_pte(physical_addr, PAGE_PRESENT | flags);
+    if (unmapped) {
+        paging_xlate_drop(dir, start, end);
+        paging_invalidate_range(dir, start, end);
+    }
+    return unmapped;
+}
+
+void paging_invalidate_page(page_directory_t* dir, uint32_t virtual_addr) {
+    uint32_t page = virtual_addr & ~(PAGE_SIZE - 1);
+    paging_xlate_drop(dir, page, page + PAGE_SIZE);
+    paging_invalidate_range(dir, page, page + PAGE_SIZE);
+}
+
+void paging_map_page(page_directory_t* dir, uint32_t virtual_addr, 
+                     uint32_t physical_addr, uint32_t flags) {
+    paging_map_range(dir, virtual_addr, physical_addr, PAGE_SIZE, flags);
 }
 
 void paging_unmap_page(page_directory_t* dir, uint32_t virtual_addr) {
-    uint32_t dir_index = paging_directory_index(virtual_addr);
-    uint32_t table_index = paging_table_index(virtual_addr);
+    paging_unmap_range(dir, virtual_addr, PAGE_SIZE, NULL);
+}
+
+uint32_t paging_get_physical_address(page_directory_t* dir, uint32_t virtual_addr) {
+    uint32_t page = virtual_addr & ~(PAGE_SIZE - 1);
+    paging_xlate_t* slot = paging_xlate_slot(dir, page);
+    if (slot->dir == dir && slot->page == page) {
+        stats.xlate_hits++;
+        return slot->frame + paging_page_offset(virtual_addr);
+    }
+    stats.xlate_misses++;
+    stats.walks++;
     
-    page_directory_entry_t* pde = &dir->entries[dir_index];
+    int loaded = paging_is_loaded(dir);
+    page_directory_entry_t pde = *paging_pde(dir, virtual_addr, loaded);
     
-    if (!paging_is_present(*pde)) {
-        return; // Page table doesn't exist
+    if (!paging_is_present(pde)) {
+        return 0; // Not mapped
     }
     
-    page_table_t* page_table = (page_table_t*)paging_get_address(*pde);
-    page_table->entries[table_index] = 0; // Clear entry
+    uint32_t frame;
+    if (pde & PAGE_SIZE_4MB) {
+        frame = (pde & PAGE_LARGE_MASK) + (page & (PAGE_SIZE_LARGE - 1));
+    } else {
+        page_table_t* page_table = paging_pde_table(pde, virtual_addr, loaded);
+        page_table_entry_t pte = page_table->entries[paging_table_index(virtual_addr)];
+        
+        if (!paging_is_present(pte)) {
+            return 0; // Not mapped
+        }
+        frame = paging_get_address(pte);
+    }
     
-    // Invalidate TLB for this page
-    __asm__ volatile("invlpg (%0)" : : "r"(virtual_addr) : "memory");
+    // Only present pages are cached: faults must still see misses
+    slot->dir = dir;
+    slot->page = page;
+    slot->frame = frame;
+    return frame + paging_page_offset(virtual_addr);
 }
 
-uint32_t paging_get_physical_address(page_directory_t* dir, uint32_t virtual_addr) {
-    uint32_t dir_index = paging_directory_index(virtual_addr);
-    uint32_t table_index = paging_table_index(virtual_addr);
-    uint32_t offset = paging_page_offset(virtual_addr);
+page_table_entry_t* paging_get_pte(page_directory_t* dir, uint32_t virtual_addr) {
+    stats.walks++;
+    int loaded = paging_is_loaded(dir);
+    page_directory_entry_t pde = *paging_pde(dir, virtual_addr, loaded);
     
-    page_directory_entry_t* pde = &dir->entries[dir_index];
+    if (!paging_is_present(pde) || (pde & PAGE_SIZE_4MB)) {
+        return NULL;
+    }
     
-    if (!paging_is_present(*pde)) {
-        return 0; // Not mapped
+    page_table_t* page_table = paging_pde_table(pde, virtual_addr, loaded);
+    return &page_table->entries[paging_table_index(virtual_addr)];
+}
+
+page_directory_t* paging_get_kernel_directory(void) {
+    return kernel_directory;
+}
+
+page_directory_t* paging_create_directory(void) {
+    page_directory_t* dir = (page_directory_t*)kmem_cache_alloc(page_directory_cache);
+    if (!dir) {
+        return NULL;
     }
     
-    page_table_t* page_table = (page_table_t*)paging_get_address(*pde);
-    page_table_entry_t pte = page_table->entries[table_index];
+    // Share the kernel's page tables so kernel mappings are identical in
+    // every address space: a 1KB copy of the kernel-half entries. The user
+    // half starts out empty.
+    for (int i = PAGE_KERNEL_FIRST_PDE; i < PAGE_RECURSIVE_SLOT; i++) {
+        dir->entries[i] = kernel_directory->entries[i];
+    }
+    dir->entries[PAGE_RECURSIVE_SLOT] =
+        paging_create_pde(virt_to_phys(dir), PAGE_PRESENT | PAGE_WRITE);
     
-    if (!paging_is_present(pte)) {
-        return 0; // Not mapped
+    return dir;
+}
+
+// Drop the references a partially built clone holds on its frames
+static void paging_release_user_frames(page_directory_t* dir) {
+    for (int i = 0; i < PAGE_KERNEL_FIRST_PDE; i++) {
+        page_directory_entry_t pde = dir->entries[i];
+        if (!paging_is_present(pde) || (pde & PAGE_SIZE_4MB)) {
+            continue;
+        }
+        
+        page_table_t* table = (page_table_t*)phys_to_virt(paging_get_address(pde));
+        for (int j = 0; j < PAGE_ENTRIES; j++) {
+            if (paging_is_present(table->entries[j])) {
+                pmm_frame_unref(paging_get_address(table->entries[j]));
+            }
+        }
+    }
+}
+
+page_directory_t* paging_clone_directory(page_directory_t* src) {
+    page_directory_t* dir = paging_create_directory();
+    if (!dir || !src) {
+        return dir;
+    }
+    
+    // Kernel entries were copied by paging_create_directory; duplicate
+    // the user-half page tables of the source
+    int loaded = paging_is_loaded(src);
+    for (int i = 0; i < PAGE_KERNEL_FIRST_PDE; i++) {
+        page_directory_entry_t pde = src->entries[i];
+        if (!paging_is_present(pde) || (pde & PAGE_SIZE_4MB)) {
+            continue;
+        }
+        
+        page_table_t* table = (page_table_t*)kmem_cache_alloc(page_table_cache);
+        if (!table) {
+            paging_release_user_frames(dir);
+            paging_destroy_directory(dir);
+            return NULL;
+        }
+        
+        page_table_t* src_table = paging_pde_table(pde, (uint32_t)i << 22, loaded);
+        for (int j = 0; j < PAGE_ENTRIES; j++) {
+            page_table_entry_t pte = src_table->entries[j];
+            if (!paging_is_present(pte)) {
+                continue;
+            }
+            
+            if (pte & PAGE_WRITE) {
+                pte = (pte & ~PAGE_WRITE) | PAGE_COW;
+                src_table->entries[j] = pte;
+            }
+            table->entries[j] = pte;
+            pmm_frame_ref(paging_get_address(pte));
+        }
+        
+        dir->entries[i] = paging_create_pde(virt_to_phys(table), paging_get_flags(pde));
+    }
+    
+    // The source lost write access to its pages; drop its cached
+    // translations if it is loaded (user pages are never global)
+    if (loaded) {
+        paging_set_cr3(virt_to_phys(src));
     }
     
-    return paging_get_address(pte) + offset;
+    return dir;
+}
+
+void paging_destroy_directory(page_directory_t* dir) {
+    if (!dir || dir == kernel_directory) {
+        return;
+    }
+    
+    // Stop using the address space before taking it apart
+    if (paging_is_loaded(dir)) {
+        paging_switch_directory(kernel_directory);
+    }
+    paging_xlate_drop(dir, 0, KERNEL_VIRTUAL_BASE);
+    
+    // Free the user-half page tables. Entries are cleared as they are
+    // visited so both objects go back to their caches zeroed. The frames
+    // mapped by those tables belong to their owners.
+    for (int i = 0; i < PAGE_ENTRIES; i++) {
+        page_directory_entry_t pde = dir->entries[i];
+        if (!pde) {
+            continue;
+        }
+        
+        if (i < PAGE_KERNEL_FIRST_PDE && paging_is_present(pde) && !(pde & PAGE_SIZE_4MB)) {
+            page_table_t* table = (page_table_t*)phys_to_virt(paging_get_address(pde));
+            for (int j = 0; j < PAGE_ENTRIES; j++) {
+                if (table->entries[j]) {
+                    table->entries[j] = 0;
+                }
+            }
+            kmem_cache_free(page_table_cache, table);
+        }
+        dir->entries[i] = 0;
+    }
+    
+    kmem_cache_free(page_directory_cache, dir);
 }
 
 page_directory_t* paging_get_current_directory(void) {
@@ -161,22 +620,52 @@ page_directory_t* paging_get_current_directory(void) {
 
 void paging_switch_directory(page_directory_t* dir) {
     current_directory = dir;
-    paging_load_directory((uint32_t*)((uint32_t)dir));
+    paging_set_cr3(virt_to_phys(dir));
 }
 
-// Page fault handler (called from interrupt handler)
-void page_fault_handler(void) {
-    // Get faulting address from CR2
-    uint32_t faulting_address;
-    __asm__ volatile("mov %%cr2, %0" : "=r"(faulting_address));
+// Page fault handler (called from isr_handler)
+// Faults in user space are resolved from the current process's VMAs; any
+// other fault is left to the caller to report.
+int page_fault_handler(uint32_t faulting_address, uint32_t error_code) {
+    stats.faults++;
+    if (faulting_address < USER_SPACE_START || faulting_address >= USER_SPACE_END) {
+        return 0;
+    }
     
-    printk_error("Page Fault!");
-    printk("  Faulting address: 0x%08X\n", faulting_address);
-    printk("  This means the address is not mapped or access was denied.\n");
+    process_t* process = process_get_current();
+    if (!process || !vma_handle_fault(process, faulting_address, error_code)) {
+        return 0;
+    }
     
-    // For now, just halt
-    // TODO: Handle page faults properly (allocate pages, swap, etc.)
-    __asm__ volatile("cli; hlt");
+    stats.faults_resolved++;
+    return 1;
+}
+
+void paging_get_stats(paging_stats_t* out) {
+    if (out) {
+        *out = stats;
+    }
+}
+
+void paging_print_stats(void) {
+    // Scale the counts down so the percentage cannot overflow
+    uint32_t hits = stats.xlate_hits;
+    uint32_t lookups = stats.xlate_hits + stats.xlate_misses;
+    while (lookups > 0x1000000) {
+        hits >>= 1;
+        lookups >>= 1;
+    }
+    
+    printk("Paging Statistics:\n");
+    printk("  Page table walks:   %u\n", stats.walks);
+    printk("  Translation cache:  %u hits, %u misses (%u%% hit rate, %u entries)\n",
+           stats.xlate_hits, stats.xlate_misses,
+           lookups ? hits * 100 / lookups : 0, PAGING_XLATE_ENTRIES);
+    printk("  Page faults:        %u (%u resolved)\n", stats.faults, stats.faults_resolved);
+    printk("  invlpg:             %u\n", stats.invlpg);
+    printk("  Full TLB flushes:   %u\n", stats.tlb_flushes);
+    printk("  CR3 loads:          %u by paging, %u by context switches (%u skipped)\n",
+           stats.cr3_loads, context_cr3_reloads, context_cr3_skips);
 }
 
 // Assembly helpers for paging control
@@ -187,12 +676,3 @@ __asm__(
     "   mov %eax, %cr3\n"          // Load into CR3
     "   ret\n"
 );
-
-__asm__(
-    ".global paging_enable_hw\n"
-    "paging_enable_hw:\n"
-    "   mov %cr0, %eax\n"          // Read CR0
-    "   or $0x80000000, %eax\n"    // Set bit 31 (PG - Paging Enable)
-    "   mov %eax, %cr0\n"          // Write back to CR0
-    "   ret\n"
-);
@@ -4,6 +4,8 @@
 #include <printk.h>
 #include <pic.h>
 #include <keyboard.h>
+#include <paging.h>
+#include <tss.h>
 
 
 
@@ -54,13 +56,6 @@ static const char* exception_messages[] = {
     "Reserved"
 };
 
-// Page fault error code flags
-#define PAGE_FAULT_PRESENT     (1 << 0)  // Page was present
-#define PAGE_FAULT_WRITE       (1 << 1)  // Write operation caused fault
-#define PAGE_FAULT_USER        (1 << 2)  // Fault occurred in user mode
-#define PAGE_FAULT_RESERVED    (1 << 3)  // Reserved bit was set
-#define PAGE_FAULT_FETCH       (1 << 4)  // Instruction fetch caused fault
-
 // Get CR2 register (page fault linear address)
 static uint32_t get_cr2(void) {
     uint32_t cr2;
@@ -110,6 +105,12 @@ static void handle_page_fault(registers_t* regs) {
 // Main interrupt service routine handler
 void isr_handler(registers_t* regs) {
     uint32_t int_no = regs->int_no;
+    
+    // Demand paging: return to restart the instruction once the page is in
+    if (int_no == 14 && page_fault_handler(get_cr2(), regs->err_code)) {
+        return;
+    }
+    
     console_clear();
     console_set_color(vga_entry_color(VGA_COLOR_WHITE, VGA_COLOR_RED));
     printk("*** KERNEL PANIC ***\n\n");
@@ -136,7 +137,7 @@ void isr_handler(registers_t* regs) {
            regs->cs & 0xFFFF, regs->ds & 0xFFFF, regs->ss & 0xFFFF);
     printk("\nStack Trace (top 8 words):\n");
     uint32_t* stack = (uint32_t*)regs->esp;
-    for (int i = 0; i < 8 && (uint32_t)stack < 0x8FFFFFFF; i++) {
+    for (int i = 0; i < 8 && (uint32_t)stack >= KERNEL_VIRTUAL_BASE; i++) {
         printk("  [ESP+%02d]: 0x%08X\n", i * 4, stack[i]);
     }
     console_set_color(vga_entry_color(VGA_COLOR_LIGHT_BROWN, VGA_COLOR_BLACK));
@@ -172,6 +173,35 @@ void irq_handler(registers_t* regs) {
     }
 }
 
+// Double fault task entry (reached through the task gate set up in idt.c).
+// The task switch saved the interrupted state into kernel_tss.
+void double_fault_task(void) {
+    uint32_t esp = kernel_tss.esp;
+    
+    console_clear();
+    console_set_color(vga_entry_color(VGA_COLOR_WHITE, VGA_COLOR_RED));
+    printk("*** KERNEL PANIC ***\n\n");
+    console_set_color(vga_entry_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK));
+    printk("CPU Exception #8: %s\n", exception_messages[8]);
+    
+    // An unmapped stack pointer in the stack region is a guard page hit
+    if (esp >= KERNEL_STACK_REGION && esp < KERNEL_STACK_REGION_END &&
+        !paging_get_physical_address(paging_get_kernel_directory(), esp - 4)) {
+        printk("Kernel stack overflow (guard page hit)\n");
+    }
+    if (get_cr2()) {
+        printk("Last page fault address: 0x%08X\n", get_cr2());
+    }
+    
+    console_set_color(vga_entry_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
+    printk("\nInterrupted state:\n");
+    printk("  EIP: 0x%08X  ESP: 0x%08X  EBP: 0x%08X  EFLAGS: 0x%08X\n",
+           kernel_tss.eip, esp, kernel_tss.ebp, kernel_tss.eflags);
+    console_set_color(vga_entry_color(VGA_COLOR_LIGHT_BROWN, VGA_COLOR_BLACK));
+    printk("\nSystem halted. Reset required.\n");
+    halt_system();
+}
+
 // General kernel panic function for manual panics
 void kernel_panic(const char* message) {
     console_clear();
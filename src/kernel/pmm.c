@@ -0,0 +1,453 @@
+// pmm.c - Physical Memory Manager (buddy page frame allocator)
+// Frames are tracked in a table with one entry per 4KB frame. Free memory is
+// kept as power-of-two blocks on per-order free lists; allocation splits the
+// smallest fitting block and freeing coalesces with the buddy block, so both
+// run in O(log n) with n = PMM_MAX_ORDER.
+#include <pmm.h>
+#include <memory.h>
+#include <paging.h>
+#include <printk.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#define PMM_NONE    0xFFFFFFFF
+
+// Frame table and free lists
+static pmm_frame_t* frames = NULL;
+static uint32_t frame_count = 0;
+static uint32_t free_lists[PMM_MAX_ORDER + 1];
+static uint32_t free_block_counts[PMM_MAX_ORDER + 1];
+
+// Frames occupied by the frame table itself
+static uint32_t metadata_start = 0;
+static uint32_t metadata_end = 0;
+
+static uint32_t memory_end = 0;
+static uint32_t usable_frames = 0;
+static uint32_t free_frames = 0;
+
+static void list_push(uint32_t order, uint32_t index) {
+    pmm_frame_t* frame = &frames[index];
+    frame->flags |= PMM_FRAME_FREE;
+    frame->order = (uint8_t)order;
+    frame->prev = PMM_NONE;
+    frame->next = free_lists[order];
+
+    if (free_lists[order] != PMM_NONE) {
+        frames[free_lists[order]].prev = index;
+    }
+    free_lists[order] = index;
+    free_block_counts[order]++;
+}
+
+static void list_remove(uint32_t order, uint32_t index) {
+    pmm_frame_t* frame = &frames[index];
+
+    if (frame->prev != PMM_NONE) {
+        frames[frame->prev].next = frame->next;
+    } else {
+        free_lists[order] = frame->next;
+    }
+    if (frame->next != PMM_NONE) {
+        frames[frame->next].prev = frame->prev;
+    }
+
+    frame->flags &= ~PMM_FRAME_FREE;
+    frame->next = PMM_NONE;
+    frame->prev = PMM_NONE;
+    free_block_counts[order]--;
+}
+
+// Insert a free block, merging with its buddy for as long as possible
+static void free_block(uint32_t index, uint32_t order) {
+    while (order < PMM_MAX_ORDER) {
+        uint32_t buddy = index ^ (1u << order);
+        if (buddy >= frame_count) {
+            break;
+        }
+
+        pmm_frame_t* frame = &frames[buddy];
+        if (!(frame->flags & PMM_FRAME_FREE) || frame->order != order) {
+            break;
+        }
+
+        list_remove(order, buddy);
+        index &= ~(1u << order);
+        order++;
+    }
+
+    list_push(order, index);
+}
+
+uint32_t pmm_metadata_size(uint32_t end) {
+    uint32_t count = end / PAGE_SIZE;
+    return PAGE_ALIGN(count * sizeof(pmm_frame_t));
+}
+
+void pmm_init(uint32_t end, uint32_t metadata_base) {
+    memory_end = end & ~(PAGE_SIZE - 1);
+    frame_count = memory_end / PAGE_SIZE;
+    frames = (pmm_frame_t*)phys_to_virt(metadata_base);
+
+    // Every frame starts out unusable; regions are added from the memory map
+    memset(frames, 0, frame_count * sizeof(pmm_frame_t));
+    for (uint32_t order = 0; order <= PMM_MAX_ORDER; order++) {
+        free_lists[order] = PMM_NONE;
+        free_block_counts[order] = 0;
+    }
+
+    metadata_start = pmm_frame_index(metadata_base);
+    metadata_end = pmm_frame_index(metadata_base + pmm_metadata_size(memory_end));
+    usable_frames = 0;
+    free_frames = 0;
+
+    printk_info("Initializing physical memory manager");
+    printk("  Tracking %u frames (%u MB)\n", frame_count, memory_end / (1024 * 1024));
+    printk("  Frame table: 0x%x - 0x%x\n",
+           metadata_base, pmm_frame_address(metadata_end));
+}
+
+// Add a run of frames [start, end) that are known not to be usable yet
+static void add_run(uint32_t start, uint32_t end) {
+    for (uint32_t i = start; i < end; i++) {
+        frames[i].flags = PMM_FRAME_USABLE;
+    }
+    usable_frames += end - start;
+    free_frames += end - start;
+
+    // Free the run as the largest naturally aligned blocks that fit
+    uint32_t index = start;
+    while (index < end) {
+        uint32_t order = 0;
+        while (order < PMM_MAX_ORDER &&
+               (index & ((2u << order) - 1)) == 0 &&
+               index + (2u << order) <= end) {
+            order++;
+        }
+        free_block(index, order);
+        index += 1u << order;
+    }
+}
+
+static void add_range(uint32_t start, uint32_t end) {
+    // Frame 0 is never handed out: address 0 signals allocation failure
+    if (start == 0) {
+        start = 1;
+    }
+
+    // Skip frames that an overlapping region already added
+    uint32_t index = start;
+    while (index < end) {
+        while (index < end && (frames[index].flags & PMM_FRAME_USABLE)) {
+            index++;
+        }
+        uint32_t run_start = index;
+        while (index < end && !(frames[index].flags & PMM_FRAME_USABLE)) {
+            index++;
+        }
+        if (run_start < index) {
+            add_run(run_start, index);
+        }
+    }
+}
+
+void pmm_add_region(uint32_t base, uint32_t length) {
+    if (!frames || length == 0) {
+        return;
+    }
+
+    // Only whole frames inside the region are usable
+    uint32_t start = pmm_frame_index(PAGE_ALIGN(base));
+    uint32_t end = (base + length < base) ? frame_count : pmm_frame_index(base + length);
+    if (end > frame_count) {
+        end = frame_count;
+    }
+    if (start >= end) {
+        return;
+    }
+
+    // Keep the frame table itself out of the free pool
+    if (start < metadata_start) {
+        add_range(start, end < metadata_start ? end : metadata_start);
+    }
+    if (end > metadata_end) {
+        add_range(start > metadata_end ? start : metadata_end, end);
+    }
+}
+
+// Pull a single free frame out of whichever free block contains it
+static int take_frame(uint32_t index) {
+    for (uint32_t order = 0; order <= PMM_MAX_ORDER; order++) {
+        uint32_t head = index & ~((1u << order) - 1);
+        pmm_frame_t* frame = &frames[head];
+
+        if (!(frame->flags & PMM_FRAME_FREE) || frame->order != order) {
+            continue;
+        }
+
+        // Split the block, returning every half not containing index
+        list_remove(order, head);
+        while (order > 0) {
+            order--;
+            uint32_t half = 1u << order;
+            if (index >= head + half) {
+                list_push(order, head);
+                head += half;
+            } else {
+                list_push(order, head + half);
+            }
+        }
+
+        free_frames--;
+        return 1;
+    }
+
+    return 0;
+}
+
+void pmm_reserve_region(uint32_t base, uint32_t length) {
+    if (!frames || length == 0) {
+        return;
+    }
+
+    // Reserve every frame the region touches
+    uint32_t start = pmm_frame_index(base);
+    uint32_t end = pmm_frame_index(PAGE_ALIGN(base + length));
+    if (end > frame_count || end < start) {
+        end = frame_count;
+    }
+
+    for (uint32_t i = start; i < end; i++) {
+        if (!(frames[i].flags & PMM_FRAME_USABLE)) {
+            continue;
+        }
+        take_frame(i);
+        frames[i].flags &= ~PMM_FRAME_USABLE;
+        usable_frames--;
+    }
+}
+
+// The free lists are also used from the page fault handler (demand-zero
+// and copy-on-write faults), so they only change with interrupts disabled
+static inline uint32_t irq_save(void) {
+    uint32_t eflags;
+    __asm__ volatile("pushf; pop %0; cli" : "=r"(eflags) : : "memory");
+    return eflags;
+}
+
+static inline void irq_restore(uint32_t eflags) {
+    if (eflags & 0x200) {
+        __asm__ volatile("sti" : : : "memory");
+    }
+}
+
+static uint32_t alloc_frames_locked(uint32_t order) {
+    if (!frames || order > PMM_MAX_ORDER) {
+        return 0;
+    }
+
+    // Find the smallest free block that is large enough
+    uint32_t current = order;
+    while (current <= PMM_MAX_ORDER && free_lists[current] == PMM_NONE) {
+        current++;
+    }
+    if (current > PMM_MAX_ORDER) {
+        return 0; // Out of physical memory
+    }
+
+    uint32_t index = free_lists[current];
+    list_remove(current, index);
+
+    // Split down to the requested order, freeing the upper halves
+    while (current > order) {
+        current--;
+        list_push(current, index + (1u << current));
+    }
+
+    frames[index].refcount = 0;
+    free_frames -= 1u << order;
+    return pmm_frame_address(index);
+}
+
+uint32_t pmm_alloc_frames(uint32_t order) {
+    uint32_t eflags = irq_save();
+    uint32_t frame = alloc_frames_locked(order);
+    irq_restore(eflags);
+    return frame;
+}
+
+// Pre-zeroed frames, used as a stack. Like the free lists, the pool is
+// only changed with interrupts disabled.
+static uint32_t zero_pool[PMM_ZERO_POOL_SIZE];
+static uint32_t zero_pool_count = 0;
+static uint32_t zero_pool_hits = 0;
+static uint32_t zero_pool_misses = 0;
+
+static uint32_t zero_pool_pop(void) {
+    uint32_t eflags = irq_save();
+    uint32_t frame = zero_pool_count ? zero_pool[--zero_pool_count] : 0;
+    irq_restore(eflags);
+    return frame;
+}
+
+uint32_t pmm_alloc_frame(void) {
+    uint32_t frame = pmm_alloc_frames(0);
+    if (!frame) {
+        // Out of memory: the pool's frames are as good as any
+        frame = zero_pool_pop();
+    }
+    return frame;
+}
+
+uint32_t pmm_alloc_zeroed_frame(void) {
+    uint32_t frame = zero_pool_pop();
+    if (frame) {
+        zero_pool_hits++;
+        return frame;
+    }
+
+    zero_pool_misses++;
+    frame = pmm_alloc_frames(0);
+    if (frame) {
+        memset(phys_to_virt(frame), 0, PAGE_SIZE);
+    }
+    return frame;
+}
+
+uint32_t pmm_zero_pool_refill(uint32_t max_frames) {
+    uint32_t added = 0;
+
+    // Leave the last frames to real allocations
+    while (added < max_frames && zero_pool_count < PMM_ZERO_POOL_SIZE &&
+           free_frames > PMM_ZERO_POOL_SIZE) {
+        uint32_t frame = pmm_alloc_frames(0);
+        if (!frame) {
+            break;
+        }
+
+        // The frame is private until pushed, so clear it with interrupts on
+        memset(phys_to_virt(frame), 0, PAGE_SIZE);
+
+        uint32_t eflags = irq_save();
+        int pushed = zero_pool_count < PMM_ZERO_POOL_SIZE;
+        if (pushed) {
+            zero_pool[zero_pool_count++] = frame;
+        } else {
+            pmm_free_frame(frame);  // Filled by someone else meanwhile
+        }
+        irq_restore(eflags);
+        if (!pushed) {
+            break;
+        }
+        added++;
+    }
+    return added;
+}
+
+static void free_frames_locked(uint32_t addr, uint32_t order) {
+    uint32_t index = pmm_frame_index(addr);
+
+    if (!frames || order > PMM_MAX_ORDER || index + (1u << order) > frame_count) {
+        return;
+    }
+    if (!(frames[index].flags & PMM_FRAME_USABLE)) {
+        printk_warn("pmm: freeing unmanaged frame 0x%x", addr);
+        return;
+    }
+    if (frames[index].flags & PMM_FRAME_FREE) {
+        printk_warn("pmm: double free of frame 0x%x", addr);
+        return;
+    }
+
+    free_frames += 1u << order;
+    free_block(index, order);
+}
+
+void pmm_free_frames(uint32_t addr, uint32_t order) {
+    uint32_t eflags = irq_save();
+    free_frames_locked(addr, order);
+    irq_restore(eflags);
+}
+
+void pmm_free_frame(uint32_t addr) {
+    pmm_free_frames(addr, 0);
+}
+
+void pmm_frame_ref(uint32_t addr) {
+    uint32_t index = pmm_frame_index(addr);
+    if (frames && index < frame_count) {
+        frames[index].refcount++;
+    }
+}
+
+void pmm_frame_unref(uint32_t addr) {
+    uint32_t index = pmm_frame_index(addr);
+    if (!frames || index >= frame_count) {
+        return;
+    }
+
+    // A fault may drop another reference to the same frame meanwhile
+    uint32_t eflags = irq_save();
+    if (frames[index].refcount > 1) {
+        frames[index].refcount--;
+    } else {
+        frames[index].refcount = 0;
+        free_frames_locked(addr, 0);
+    }
+    irq_restore(eflags);
+}
+
+uint32_t pmm_frame_refcount(uint32_t addr) {
+    uint32_t index = pmm_frame_index(addr);
+    if (!frames || index >= frame_count) {
+        return 0;
+    }
+    return frames[index].refcount;
+}
+
+uint32_t pmm_get_memory_end(void) {
+    return memory_end;
+}
+
+uint32_t pmm_get_free_memory(void) {
+    return free_frames * PAGE_SIZE;
+}
+
+void pmm_get_stats(pmm_stats_t* stats) {
+    if (!stats) {
+        return;
+    }
+
+    stats->total_frames = usable_frames;
+    stats->free_frames = free_frames;
+    for (uint32_t order = 0; order <= PMM_MAX_ORDER; order++) {
+        stats->free_blocks[order] = free_block_counts[order];
+    }
+    stats->zero_pool_frames = zero_pool_count;
+    stats->zero_pool_hits = zero_pool_hits;
+    stats->zero_pool_misses = zero_pool_misses;
+}
+
+void pmm_print_stats(void) {
+    pmm_stats_t stats;
+    pmm_get_stats(&stats);
+
+    printk("\nPhysical Memory:\n");
+    printk("  Usable frames:   %u (%u KB)\n",
+           stats.total_frames, stats.total_frames * (PAGE_SIZE / 1024));
+    printk("  Free frames:     %u (%u KB)\n",
+           stats.free_frames, stats.free_frames * (PAGE_SIZE / 1024));
+    printk("  Free blocks by order:");
+    for (uint32_t order = 0; order <= PMM_MAX_ORDER; order++) {
+        printk(" %u", stats.free_blocks[order]);
+    }
+    printk("\n");
+    printk("  Zeroed pool:     %u/%u frames, %u hits, %u misses\n",
+           stats.zero_pool_frames, PMM_ZERO_POOL_SIZE,
+           stats.zero_pool_hits, stats.zero_pool_misses);
+}
+
+uint32_t memory_get_total(void) {
+    // Highest physical address tracked by the frame allocator
+    return memory_end;
+}
@@ -4,11 +4,12 @@
 #include <stdint.h>
 #include <stddef.h>
 #include <stdarg.h>
+#include <memory.h>
 
 // VGA text mode constants
 #define VGA_WIDTH 80
 #define VGA_HEIGHT 25
-#define VGA_MEMORY ((volatile uint16_t*)0xB8000)
+#define VGA_MEMORY ((volatile uint16_t*)(KERNEL_VIRTUAL_BASE + 0xB8000))
 
 // Console state
 static size_t console_row = 0;
@@ -1,17 +1,45 @@
 // process.c - Process Management Implementation
 #include <process.h>
 #include <memory.h>
+#include <pmm.h>
+#include <kmem_cache.h>
+#include <vma.h>
 #include <printk.h>
 #include <timer.h>
 
-// Process table and tracking
-process_t process_table[MAX_PROCESSES];
+// Process table and tracking (NULL = free slot)
+process_t* process_table[MAX_PROCESSES];
 process_t* current_process = NULL;
 uint32_t next_pid = 0;
 
-// Static stack allocation (avoids heap fragmentation)
-static uint8_t process_stacks[MAX_PROCESSES][KERNEL_STACK_SIZE] __attribute__((aligned(16)));
-static int stack_allocated[MAX_PROCESSES] = {0};
+
+// Process control blocks are recycled zeroed through an object cache
+static kmem_cache_t* process_cache = NULL;
+
+// Kernel stacks
+// Process 'pid' owns slot 'pid' of the kernel stack region: an unmapped
+// guard page followed by KERNEL_STACK_SIZE bytes backed by frames allocated
+// on demand. Overflowing a stack faults on the guard page instead of
+// corrupting the stack below it.
+static void kernel_stack_free(uint32_t stack, uint32_t size) {
+    paging_unmap_range(paging_get_kernel_directory(), stack, size, pmm_free_frame);
+}
+
+static uint32_t kernel_stack_alloc(uint32_t pid) {
+    page_directory_t* dir = paging_get_kernel_directory();
+    uint32_t stack = KERNEL_STACK_REGION + pid * KERNEL_STACK_SLOT + PAGE_SIZE;
+    
+    for (uint32_t offset = 0; offset < KERNEL_STACK_SIZE; offset += PAGE_SIZE) {
+        uint32_t frame = pmm_alloc_frame();
+        if (!frame) {
+            kernel_stack_free(stack, offset);
+            return 0;
+        }
+        paging_map_page(dir, stack + offset, frame, PAGE_WRITE | PAGE_GLOBAL);
+    }
+    
+    return stack;
+}
 
 // String utilities (simple implementations)
 static size_t strlen(const char* str) {
@@ -35,17 +63,20 @@ static char* strncpy_local(char* dest, const char* src, size_t n) {
 void process_init(void) {
     printk_info("Initializing process management subsystem");
     
+    process_cache = kmem_cache_create("process", sizeof(process_t),
+                                      kmem_ctor_zero, 0);
+    vma_init();
+    
     // Clear process table
     memset(process_table, 0, sizeof(process_table));
     
-    // Mark all processes as terminated (free)
-    for (int i = 0; i < MAX_PROCESSES; i++) {
-        process_table[i].state = PROCESS_STATE_TERMINATED;
-        process_table[i].pid = i;
-    }
-    
     // Create kernel idle process (PID 0)
-    process_t* idle = &process_table[0];
+    process_t* idle = (process_t*)kmem_cache_alloc(process_cache);
+    if (!idle) {
+        printk_error("Failed to allocate idle process");
+        return;
+    }
+    process_table[0] = idle;
     idle->pid = 0;
     strncpy_local(idle->name, "kernel_idle", 31);
     idle->name[31] = '\0';
@@ -76,7 +107,7 @@ void process_init(void) {
 uint32_t process_allocate_pid(void) {
     // Simple linear search for free slot
     for (uint32_t i = next_pid; i < MAX_PROCESSES; i++) {
-        if (process_table[i].state == PROCESS_STATE_TERMINATED) {
+        if (!process_table[i]) {
             next_pid = i + 1;
             return i;
         }
@@ -84,7 +115,7 @@ uint32_t process_allocate_pid(void) {
     
     // Wrap around
     for (uint32_t i = 1; i < next_pid; i++) {
-        if (process_table[i].state == PROCESS_STATE_TERMINATED) {
+        if (!process_table[i]) {
             next_pid = i + 1;
             return i;
         }
@@ -97,7 +128,7 @@ uint32_t process_allocate_pid(void) {
 // Free a PID
 void process_free_pid(uint32_t pid) {
     if (pid < MAX_PROCESSES) {
-        process_table[pid].state = PROCESS_STATE_TERMINATED;
+        process_table[pid] = NULL;
     }
 }
 
@@ -111,10 +142,13 @@ process_t* process_create(const char* name, void (*entry_point)(void),
         return NULL;
     }
     
-    process_t* process = &process_table[pid];
-    
-    // Initialize process structure
-    memset(process, 0, sizeof(process_t));
+    // Control blocks come out of the cache already zeroed
+    process_t* process = (process_t*)kmem_cache_alloc(process_cache);
+    if (!process) {
+        printk_error("Failed to create process: out of memory");
+        return NULL;
+    }
+    process_table[pid] = process;
     process->pid = pid;
     
     // Copy name
@@ -130,14 +164,14 @@ process_t* process_create(const char* name, void (*entry_point)(void),
     process->priority = priority;
     process->quantum = 10;  // Default time slice
     
-    // Use pre-allocated static stack (no kmalloc needed!)
-    if (pid < MAX_PROCESSES && !stack_allocated[pid]) {
-        process->kernel_stack = (uint32_t)&process_stacks[pid][0];
-        stack_allocated[pid] = 1;
-        printk("  Using static stack at 0x%08X\n", process->kernel_stack);
+    // Map a fresh kernel stack below a guard page
+    process->kernel_stack = kernel_stack_alloc(pid);
+    if (process->kernel_stack) {
+        printk("  Kernel stack at 0x%08X\n", process->kernel_stack);
     } else {
         printk_error("Failed to allocate stack for process %d", pid);
         process_free_pid(pid);
+        kmem_cache_free(process_cache, process);
         return NULL;
     }
     
@@ -154,8 +188,16 @@ process_t* process_create(const char* name, void (*entry_point)(void),
     // Set initial flags (interrupts enabled)
     process->registers.eflags = 0x202;
     
+    // Kernel data segments (user mode setup replaces them)
+    process->registers.ds = 0x10;
+    process->registers.es = 0x10;
+    process->registers.fs = 0x10;
+    process->registers.gs = 0x10;
+    process->registers.ss = 0x10;
+    
     // Use current page directory for now
     process->page_directory = paging_get_current_directory();
+    process->registers.cr3 = virt_to_phys(process->page_directory);
     
     // Set parent as current process
     process->parent = current_process;
@@ -204,7 +246,7 @@ void process_destroy(process_t* process) {
     }
     
     // Reparent children to init (PID 1) or idle (PID 0)
-    process_t* new_parent = (next_pid > 1) ? &process_table[1] : &process_table[0];
+    process_t* new_parent = process_table[1] ? process_table[1] : process_table[0];
     for (uint32_t i = 0; i < process->num_children; i++) {
         process->children[i]->parent = new_parent;
         if (new_parent->num_children < 16) {
@@ -212,15 +254,63 @@ void process_destroy(process_t* process) {
         }
     }
     
-    // Mark stack as free
-    if (process->pid < MAX_PROCESSES) {
-        stack_allocated[process->pid] = 0;
+    // A sleeping process must not be woken after it is gone
+    timer_event_cancel(&process->sleep_timer);
+    
+    // Release the kernel stack
+    if (process->kernel_stack) {
+        kernel_stack_free(process->kernel_stack, KERNEL_STACK_SIZE);
+        process->kernel_stack = 0;
+    }
+    
+    // Release scratch allocations
+    if (process->arena) {
+        arena_destroy(process->arena);
+        process->arena = NULL;
     }
     
-    // Mark as terminated
-    process->state = PROCESS_STATE_TERMINATED;
+    // Release user memory and the private address space
+    vma_release_all(process);
+    if (process->page_directory &&
+        process->page_directory != paging_get_kernel_directory()) {
+        paging_destroy_directory(process->page_directory);
+    }
+    process->page_directory = NULL;
     
     printk("  Destroyed process '%s' (PID %d)\n", process->name, process->pid);
+    
+    // Release the slot and return the control block zeroed
+    process_free_pid(process->pid);
+    memset(process, 0, sizeof(process_t));
+    kmem_cache_free(process_cache, process);
+}
+
+// Fork a user process
+process_t* process_fork(process_t* parent) {
+    if (!parent || !parent->vmas) {
+        printk_error("Only user processes can fork");
+        return NULL;
+    }
+    
+    process_t* child = process_create(parent->name, NULL, parent->priority);
+    if (!child) {
+        return NULL;
+    }
+    
+    // Copy the memory areas first: once the directory is cloned the child
+    // holds a reference on every resident frame, and only its VMAs can
+    // give them back. Until then it has no address space to release.
+    child->page_directory = NULL;
+    if (vma_clone(parent, child) != 0 ||
+        !(child->page_directory = paging_clone_directory(parent->page_directory))) {
+        printk_error("Out of memory forking process %d", parent->pid);
+        process_destroy(child);
+        return NULL;
+    }
+    child->registers.cr3 = virt_to_phys(child->page_directory);
+    child->is_kernel = 0;
+    
+    return child;
 }
 
 // Exit current process
@@ -272,14 +362,26 @@ process_t* process_get_by_pid(uint32_t pid) {
         return NULL;
     }
     
-    process_t* process = &process_table[pid];
-    if (process->state == PROCESS_STATE_TERMINATED) {
+    process_t* process = process_table[pid];
+    if (!process || process->state == PROCESS_STATE_TERMINATED) {
         return NULL;
     }
     
     return process;
 }
 
+// Get the process's scratch arena, creating it on first use
+arena_t* process_get_arena(process_t* process) {
+    if (!process) {
+        return NULL;
+    }
+
+    if (!process->arena) {
+        process->arena = arena_create();
+    }
+    return process->arena;
+}
+
 // Print process information
 void process_print_info(process_t* process) {
     if (!process) {
@@ -296,6 +398,7 @@ void process_print_info(process_t* process) {
     printk("    Children: %d\n", process->num_children);
     printk("    Runtime:  %d ticks\n", process->time_running);
     printk("    Switches: %d\n", process->context_switches);
+    vma_print(process);
 }
 
 // List all processes
@@ -306,13 +409,14 @@ void process_list_all(void) {
     
     int count = 0;
     for (int i = 0; i < MAX_PROCESSES; i++) {
-        if (process_table[i].state != PROCESS_STATE_TERMINATED) {
+        process_t* process = process_table[i];
+        if (process && process->state != PROCESS_STATE_TERMINATED) {
             printk("%-4d %-18s  %-10s  %-8d  %d\n",
-                   process_table[i].pid,
-                   process_table[i].name,
-                   process_get_state_name(process_table[i].state),
-                   process_table[i].priority,
-                   process_table[i].time_running);
+                   process->pid,
+                   process->name,
+                   process_get_state_name(process->state),
+                   process->priority,
+                   process->time_running);
             count++;
         }
     }
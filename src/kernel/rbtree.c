@@ -0,0 +1,229 @@
+// rbtree.c - Intrusive red-black trees
+#include <rbtree.h>
+#include <stdint.h>
+#include <stddef.h>
+
+// Make new_child take old_child's place under parent (the root if NULL)
+static void rb_set_child(rb_tree_t* tree, rb_node_t* parent,
+                         rb_node_t* old_child, rb_node_t* new_child) {
+    if (!parent) {
+        tree->root = new_child;
+    } else if (parent->left == old_child) {
+        parent->left = new_child;
+    } else {
+        parent->right = new_child;
+    }
+}
+
+static void rb_rotate_left(rb_tree_t* tree, rb_node_t* node) {
+    rb_node_t* right = node->right;
+
+    node->right = right->left;
+    if (right->left) {
+        right->left->parent = node;
+    }
+    right->parent = node->parent;
+    rb_set_child(tree, node->parent, node, right);
+    right->left = node;
+    node->parent = right;
+}
+
+static void rb_rotate_right(rb_tree_t* tree, rb_node_t* node) {
+    rb_node_t* left = node->left;
+
+    node->left = left->right;
+    if (left->right) {
+        left->right->parent = node;
+    }
+    left->parent = node->parent;
+    rb_set_child(tree, node->parent, node, left);
+    left->right = node;
+    node->parent = left;
+}
+
+static inline int rb_is_red(const rb_node_t* node) {
+    return node && node->red;
+}
+
+void rb_insert(rb_tree_t* tree, rb_node_t* node, rb_node_t* parent,
+               rb_node_t** link, int leftmost) {
+    node->parent = parent;
+    node->left = NULL;
+    node->right = NULL;
+    node->red = 1;
+    *link = node;
+    if (leftmost) {
+        tree->leftmost = node;
+    }
+
+    // A red node may not have a red parent; the parent is never the root
+    // here, since the root is black
+    while ((parent = node->parent) && parent->red) {
+        rb_node_t* grandparent = parent->parent;
+
+        if (parent == grandparent->left) {
+            rb_node_t* uncle = grandparent->right;
+            if (rb_is_red(uncle)) {
+                parent->red = 0;
+                uncle->red = 0;
+                grandparent->red = 1;
+                node = grandparent;
+                continue;
+            }
+            if (node == parent->right) {
+                rb_rotate_left(tree, parent);
+                node = parent;
+                parent = node->parent;
+            }
+            parent->red = 0;
+            grandparent->red = 1;
+            rb_rotate_right(tree, grandparent);
+        } else {
+            rb_node_t* uncle = grandparent->left;
+            if (rb_is_red(uncle)) {
+                parent->red = 0;
+                uncle->red = 0;
+                grandparent->red = 1;
+                node = grandparent;
+                continue;
+            }
+            if (node == parent->left) {
+                rb_rotate_right(tree, parent);
+                node = parent;
+                parent = node->parent;
+            }
+            parent->red = 0;
+            grandparent->red = 1;
+            rb_rotate_left(tree, grandparent);
+        }
+    }
+    tree->root->red = 0;
+}
+
+// Restore the black height after a black node was removed above 'node'
+// (which may be NULL, hence the separate parent)
+static void rb_erase_fixup(rb_tree_t* tree, rb_node_t* node, rb_node_t* parent) {
+    while (node != tree->root && !rb_is_red(node)) {
+        if (node == parent->left) {
+            rb_node_t* sibling = parent->right;
+            if (sibling->red) {
+                sibling->red = 0;
+                parent->red = 1;
+                rb_rotate_left(tree, parent);
+                sibling = parent->right;
+            }
+            if (!rb_is_red(sibling->left) && !rb_is_red(sibling->right)) {
+                sibling->red = 1;
+                node = parent;
+                parent = node->parent;
+                continue;
+            }
+            if (!rb_is_red(sibling->right)) {
+                sibling->left->red = 0;
+                sibling->red = 1;
+                rb_rotate_right(tree, sibling);
+                sibling = parent->right;
+            }
+            sibling->red = parent->red;
+            parent->red = 0;
+            sibling->right->red = 0;
+            rb_rotate_left(tree, parent);
+        } else {
+            rb_node_t* sibling = parent->left;
+            if (sibling->red) {
+                sibling->red = 0;
+                parent->red = 1;
+                rb_rotate_right(tree, parent);
+                sibling = parent->left;
+            }
+            if (!rb_is_red(sibling->left) && !rb_is_red(sibling->right)) {
+                sibling->red = 1;
+                node = parent;
+                parent = node->parent;
+                continue;
+            }
+            if (!rb_is_red(sibling->left)) {
+                sibling->right->red = 0;
+                sibling->red = 1;
+                rb_rotate_left(tree, sibling);
+                sibling = parent->left;
+            }
+            sibling->red = parent->red;
+            parent->red = 0;
+            sibling->left->red = 0;
+            rb_rotate_right(tree, parent);
+        }
+        node = tree->root;
+    }
+    if (node) {
+        node->red = 0;
+    }
+}
+
+void rb_erase(rb_tree_t* tree, rb_node_t* node) {
+    rb_node_t* child;
+    rb_node_t* parent;
+    int removed_red;
+
+    if (tree->leftmost == node) {
+        tree->leftmost = rb_next(node);
+    }
+
+    if (node->left && node->right) {
+        // Two children: the successor (leftmost of the right subtree)
+        // takes the node's place and colour
+        rb_node_t* successor = node->right;
+        while (successor->left) {
+            successor = successor->left;
+        }
+
+        child = successor->right;
+        parent = successor->parent;
+        removed_red = successor->red;
+
+        if (parent == node) {
+            parent = successor;
+        } else {
+            if (child) {
+                child->parent = parent;
+            }
+            parent->left = child;
+            successor->right = node->right;
+            node->right->parent = successor;
+        }
+
+        successor->left = node->left;
+        node->left->parent = successor;
+        successor->parent = node->parent;
+        rb_set_child(tree, node->parent, node, successor);
+        successor->red = node->red;
+    } else {
+        child = node->left ? node->left : node->right;
+        parent = node->parent;
+        removed_red = node->red;
+
+        if (child) {
+            child->parent = parent;
+        }
+        rb_set_child(tree, parent, node, child);
+    }
+
+    if (!removed_red) {
+        rb_erase_fixup(tree, child, parent);
+    }
+}
+
+rb_node_t* rb_next(const rb_node_t* node) {
+    if (node->right) {
+        node = node->right;
+        while (node->left) {
+            node = node->left;
+        }
+        return (rb_node_t*)node;
+    }
+
+    while (node->parent && node == node->parent->right) {
+        node = node->parent;
+    }
+    return node->parent;
+}
@@ -1,4 +1,4 @@
-// scheduler.c - Process Scheduler (Round-Robin)
+// scheduler.c - Process Scheduler (priority round-robin or fair)
 #include <scheduler.h>
 #include <process.h>
 #include <context.h>
@@ -6,90 +6,254 @@
 #include <timer.h>
 #include <memory.h>
 #include <tss.h>
+#include <pmm.h>
+#include <rbtree.h>
 
-// Ready queue (simple linked list)
-static process_t* ready_queue_head = NULL;
-static process_t* ready_queue_tail = NULL;
+// Ready queues: one FIFO per priority level, plus a bitmap of the levels
+// that have ready processes, so picking the next process is a bit scan
+// and a dequeue. Higher levels always run first; a level's processes
+// share the CPU round-robin.
+typedef struct {
+    process_t* head;
+    process_t* tail;
+} run_queue_t;
+
+static run_queue_t run_queues[SCHED_PRIORITY_LEVELS];
+static uint32_t ready_bitmap = 0;       // Bit p set: run_queues[p] is not empty
 static uint32_t ready_queue_count = 0;
 
+// Fair policy: ready processes ordered by vruntime in a red-black tree whose
+// cached leftmost node is the next to run. The idle process (PID 0) is
+// never in it; it runs only when the tree is empty.
+static rb_tree_t fair_queue = { NULL, NULL };
+static uint64_t fair_min_vruntime = 0;  // vruntime of the last process picked
+
+// Relative CPU share per priority level (~3x per level from LOW up;
+// PROCESS_PRIORITY_IDLE processes only get a token share)
+static const uint32_t fair_weights[SCHED_PRIORITY_LEVELS] = {
+    15, 335, SCHED_FAIR_WEIGHT_NORMAL, 3121, 9548
+};
+
+static sched_policy_t sched_policy = SCHED_POLICY_PRIORITY;
+
+static inline uint32_t irq_save(void) {
+    uint32_t eflags;
+    __asm__ volatile("pushf; pop %0; cli" : "=r"(eflags) : : "memory");
+    return eflags;
+}
+
+static inline void irq_restore(uint32_t eflags) {
+    if (eflags & 0x200) {
+        __asm__ volatile("sti" : : : "memory");
+    }
+}
+
 // Scheduler state
 static int scheduler_enabled = 0;
 static uint32_t quantum_ticks = 10;  // Time slice per process (in timer ticks)
 
+// Switch trace: slot (n & (SCHED_TRACE_SIZE - 1)) holds event n. A writer
+// claims its slot with one atomic increment, so recording never takes a
+// lock and an interrupting writer just claims the next slot.
+static sched_trace_event_t trace_ring[SCHED_TRACE_SIZE];
+static volatile uint32_t trace_head = 0;   // Events recorded since clearing
+
+static inline void scheduler_trace(process_t* old_process, process_t* new_process,
+                                   sched_trace_reason_t reason) {
+    uint32_t n = __atomic_fetch_add(&trace_head, 1, __ATOMIC_RELAXED);
+    sched_trace_event_t* event = &trace_ring[n & (SCHED_TRACE_SIZE - 1)];
+    
+    event->tick = timer_get_ticks();
+    event->old_pid = (uint16_t)old_process->pid;
+    event->new_pid = (uint16_t)new_process->pid;
+    event->reason = reason;
+}
+
+// Updated by context_switch
+uint32_t context_cr3_reloads = 0;
+uint32_t context_cr3_skips = 0;
+
 // Initialize scheduler
 void scheduler_init(void) {
     printk_info("Initializing process scheduler");
     
-    ready_queue_head = NULL;
-    ready_queue_tail = NULL;
+    for (uint32_t level = 0; level < SCHED_PRIORITY_LEVELS; level++) {
+        run_queues[level].head = NULL;
+        run_queues[level].tail = NULL;
+    }
+    ready_bitmap = 0;
+    fair_queue.root = NULL;
+    fair_queue.leftmost = NULL;
+    fair_min_vruntime = 0;
     ready_queue_count = 0;
     scheduler_enabled = 0;
     
-    printk("  Scheduling algorithm: Round-Robin\n");
+    printk("  Scheduling algorithm: %s (%d levels)\n",
+           scheduler_policy_name(sched_policy), SCHED_PRIORITY_LEVELS);
     printk("  Time quantum: %d ticks (%d ms)\n", quantum_ticks, quantum_ticks * 10);
     printk("  [OK] Scheduler initialized (not yet enabled)\n");
 }
 
-// Add process to ready queue
-void scheduler_add_process(process_t* process) {
-    if (!process || process->state == PROCESS_STATE_TERMINATED) {
-        return;
+// Run queue level of a process (its priority must not change while queued)
+static inline uint32_t scheduler_level(process_t* process) {
+    if ((uint32_t)process->priority >= SCHED_PRIORITY_LEVELS) {
+        return PROCESS_PRIORITY_NORMAL;
     }
+    return (uint32_t)process->priority;
+}
+
+// Highest level with a ready process (ready_bitmap must not be 0)
+static inline uint32_t scheduler_highest_level(void) {
+    return 31 - (uint32_t)__builtin_clz(ready_bitmap);
+}
+
+static void priority_enqueue(process_t* process) {
+    uint32_t level = scheduler_level(process);
+    run_queue_t* queue = &run_queues[level];
     
-    // Set process state to READY
-    process->state = PROCESS_STATE_READY;
     process->next = NULL;
-    process->prev = ready_queue_tail;
+    process->prev = queue->tail;
     
-    // Add to tail of ready queue
-    if (ready_queue_tail) {
-        ready_queue_tail->next = process;
+    // Add to tail of its level's queue
+    if (queue->tail) {
+        queue->tail->next = process;
     } else {
-        ready_queue_head = process;
+        queue->head = process;
+        ready_bitmap |= 1u << level;
     }
-    ready_queue_tail = process;
-    ready_queue_count++;
-    
-    printk("  Added process '%s' (PID %d) to ready queue\n", 
-           process->name, process->pid);
+    queue->tail = process;
 }
 
-// Remove process from ready queue
-void scheduler_remove_process(process_t* process) {
-    if (!process) {
-        return;
+static int priority_dequeue(process_t* process) {
+    uint32_t level = scheduler_level(process);
+    run_queue_t* queue = &run_queues[level];
+    
+    // Not queued
+    if (!process->prev && queue->head != process) {
+        return 0;
     }
     
     // Update links
     if (process->prev) {
         process->prev->next = process->next;
     } else {
-        ready_queue_head = process->next;
+        queue->head = process->next;
     }
     
     if (process->next) {
         process->next->prev = process->prev;
     } else {
-        ready_queue_tail = process->prev;
+        queue->tail = process->prev;
+    }
+    
+    if (!queue->head) {
+        ready_bitmap &= ~(1u << level);
     }
     
     process->next = NULL;
     process->prev = NULL;
+    return 1;
+}
+
+static void fair_enqueue(process_t* process) {
+    // A process that slept or is new starts no further behind than the
+    // queue's minimum, so it cannot monopolize the CPU to catch up
+    if (process->vruntime < fair_min_vruntime) {
+        process->vruntime = fair_min_vruntime;
+    }
     
-    if (ready_queue_count > 0) {
+    // Equal keys go right, keeping FIFO order among them
+    rb_node_t** link = &fair_queue.root;
+    rb_node_t* parent = NULL;
+    int leftmost = 1;
+    while (*link) {
+        parent = *link;
+        if (process->vruntime < rb_entry(parent, process_t, run_node)->vruntime) {
+            link = &parent->left;
+        } else {
+            link = &parent->right;
+            leftmost = 0;
+        }
+    }
+    rb_insert(&fair_queue, &process->run_node, parent, link, leftmost);
+}
+
+static int fair_dequeue(process_t* process) {
+    rb_node_t* node = &process->run_node;
+    
+    // Not queued
+    if (!node->parent && fair_queue.root != node) {
+        return 0;
+    }
+    
+    rb_erase(&fair_queue, node);
+    node->parent = NULL;
+    node->left = NULL;
+    node->right = NULL;
+    return 1;
+}
+
+// Add process to ready queue
+void scheduler_add_process(process_t* process) {
+    if (!process || process->state == PROCESS_STATE_TERMINATED) {
+        return;
+    }
+    
+    // Set process state to READY
+    process->state = PROCESS_STATE_READY;
+    
+    // The idle process is never queued: it only runs when nothing else is
+    // ready, and queued at the lowest level it could starve whatever it runs
+    if (process->pid == 0) {
+        return;
+    }
+    if (sched_policy == SCHED_POLICY_FAIR) {
+        fair_enqueue(process);
+    } else {
+        priority_enqueue(process);
+    }
+    ready_queue_count++;
+    
+    // The timer may be skipping ticks while nothing else was ready
+    if (scheduler_enabled) {
+        timer_restart_tick();
+    }
+}
+
+// Remove process from ready queue
+void scheduler_remove_process(process_t* process) {
+    if (!process) {
+        return;
+    }
+    
+    int removed = sched_policy == SCHED_POLICY_FAIR ? fair_dequeue(process)
+                                                    : priority_dequeue(process);
+    if (removed && ready_queue_count > 0) {
         ready_queue_count--;
     }
 }
 
-// Pick next process to run (round-robin)
+// Pick next process to run: the head of the highest non-empty level, or
+// the smallest virtual runtime under the fair policy
 process_t* scheduler_schedule(void) {
-    if (!ready_queue_head) {
-        // No ready processes, return idle process (PID 0)
-        return &process_table[0];
+    process_t* next = NULL;
+    if (sched_policy == SCHED_POLICY_FAIR) {
+        rb_node_t* first = rb_first(&fair_queue);
+        if (first) {
+            next = rb_entry(first, process_t, run_node);
+            fair_min_vruntime = next->vruntime;
+        }
+    } else if (ready_bitmap) {
+        next = run_queues[scheduler_highest_level()].head;
     }
     
-    // Get first process from ready queue
-    process_t* next = ready_queue_head;
+    if (!next) {
+        // No ready processes, return idle process (PID 0)
+        next = process_table[0];
+        next->state = PROCESS_STATE_RUNNING;
+        next->quantum = quantum_ticks;
+        return next;
+    }
     
     // Remove from queue
     scheduler_remove_process(next);
@@ -101,6 +265,64 @@ process_t* scheduler_schedule(void) {
     return next;
 }
 
+// Whether a ready process should take the CPU from the current one before
+// its quantum runs out
+static int scheduler_should_preempt(process_t* current) {
+    if (sched_policy == SCHED_POLICY_FAIR) {
+        // The idle process is outside the tree and yields to anything in it
+        rb_node_t* first = rb_first(&fair_queue);
+        if (current->pid == 0) {
+            return first != NULL;
+        }
+        return first && current->vruntime >
+               rb_entry(first, process_t, run_node)->vruntime + SCHED_FAIR_GRANULARITY;
+    }
+    return ready_bitmap && scheduler_highest_level() > scheduler_level(current);
+}
+
+void scheduler_set_policy(sched_policy_t policy) {
+    if (policy == sched_policy) {
+        return;
+    }
+    
+    // Move every ready process over to the other policy's queue
+    uint32_t eflags = irq_save();
+    
+    process_t* ready = NULL;
+    for (uint32_t i = 0; i < MAX_PROCESSES; i++) {
+        process_t* process = process_table[i];
+        if (process && (sched_policy == SCHED_POLICY_FAIR ? fair_dequeue(process)
+                                                          : priority_dequeue(process))) {
+            process->next = ready;
+            ready = process;
+        }
+    }
+    
+    sched_policy = policy;
+    fair_min_vruntime = 0;
+    while (ready) {
+        process_t* process = ready;
+        ready = process->next;
+        process->vruntime = 0;
+        if (policy == SCHED_POLICY_FAIR) {
+            fair_enqueue(process);
+        } else {
+            priority_enqueue(process);
+        }
+    }
+    
+    irq_restore(eflags);
+    printk_info("Scheduling policy: %s", scheduler_policy_name(policy));
+}
+
+sched_policy_t scheduler_get_policy(void) {
+    return sched_policy;
+}
+
+const char* scheduler_policy_name(sched_policy_t policy) {
+    return policy == SCHED_POLICY_FAIR ? "Fair (virtual runtime)" : "Priority Round-Robin";
+}
+
 // Enable scheduler
 void scheduler_enable(void) {
     if (scheduler_enabled) {
@@ -110,6 +332,7 @@ void scheduler_enable(void) {
     
     printk_info("Enabling process scheduler");
     scheduler_enabled = 1;
+    timer_restart_tick();
 }
 
 // Disable scheduler
@@ -128,22 +351,56 @@ uint32_t scheduler_get_ready_count(void) {
     return ready_queue_count;
 }
 
+int scheduler_needs_tick(void) {
+    // The idle process is never queued, so this counts only real work
+    return scheduler_enabled && ready_queue_count > 0;
+}
+
+// Hand the CPU from old_process to next_process
+static void scheduler_switch(process_t* old_process, process_t* next_process,
+                             sched_trace_reason_t reason) {
+    scheduler_trace(old_process, next_process, reason);
+    
+    // Update TSS kernel stack for the new process
+    // When this process enters ring 3 and triggers interrupt/exception,
+    // CPU will load esp0 from TSS for kernel stack
+    uint32_t kernel_stack = (uint32_t)next_process->kernel_stack + KERNEL_STACK_SIZE;
+    tss_set_kernel_stack(kernel_stack);
+    
+    // Update current process pointer
+    current_process = next_process;
+    
+    // Increment context switch counters
+    old_process->context_switches++;
+    next_process->context_switches++;
+    
+    // Perform the actual context switch
+    context_switch(&old_process->registers, &next_process->registers);
+}
+
 // Called from timer interrupt
-void scheduler_tick(void) {
+void scheduler_tick(uint32_t ticks) {
     if (!scheduler_enabled || !current_process) {
         return;
     }
     
     // Update running time
-    current_process->time_running++;
+    current_process->time_running += ticks;
+    if (sched_policy == SCHED_POLICY_FAIR && current_process->pid != 0) {
+        current_process->vruntime += (uint64_t)ticks *
+            (SCHED_FAIR_WEIGHT_NORMAL * SCHED_FAIR_TICK /
+             fair_weights[scheduler_level(current_process)]);
+    }
     
     // Check if quantum expired
-    if (current_process->quantum > 0) {
-        current_process->quantum--;
-    }
+    current_process->quantum = current_process->quantum > ticks ?
+                               current_process->quantum - ticks : 0;
     
-    // Context switch if quantum expired and there are ready processes
-    if (current_process->quantum == 0 && ready_queue_count > 0) {
+    // Context switch if quantum expired and there are ready processes, or
+    // right away if a process of higher priority (or, under the fair
+    // policy, one far enough behind in vruntime) became ready
+    int preempt = scheduler_should_preempt(current_process);
+    if ((current_process->quantum == 0 && ready_queue_count > 0) || preempt) {
         // Save current process
         process_t* old_process = current_process;
         
@@ -156,34 +413,8 @@ void scheduler_tick(void) {
         process_t* next_process = scheduler_schedule();
         
         if (next_process && next_process != old_process) {
-            // Debug logging
-            printk("[SCHED] Switching: PID %d (%s, %s) -> PID %d (%s, %s)\n",
-                   old_process->pid, old_process->name, 
-                   old_process->is_kernel ? "kernel" : "user",
-                   next_process->pid, next_process->name,
-                   next_process->is_kernel ? "kernel" : "user");
-            printk("        Old: ESP=0x%x EIP=0x%x DS=0x%x\n",
-                   old_process->registers.esp, old_process->registers.eip,
-                   old_process->registers.ds);
-            printk("        New: ESP=0x%x EIP=0x%x DS=0x%x\n",
-                   next_process->registers.esp, next_process->registers.eip,
-                   next_process->registers.ds);
-            
-            // Update TSS kernel stack for the new process
-            // When this process enters ring 3 and triggers interrupt/exception,
-            // CPU will load esp0 from TSS for kernel stack
-            uint32_t kernel_stack = (uint32_t)next_process->kernel_stack + 4096;
-            tss_set_kernel_stack(kernel_stack);
-            
-            // Update current process pointer
-            current_process = next_process;
-            
-            // Increment context switch counters
-            old_process->context_switches++;
-            next_process->context_switches++;
-            
-            // Perform the actual context switch
-            context_switch(&old_process->registers, &next_process->registers);
+            scheduler_switch(old_process, next_process,
+                             preempt ? SCHED_TRACE_PREEMPT : SCHED_TRACE_QUANTUM);
         }
     } else if (current_process->quantum == 0) {
         // Reset quantum if no ready processes
@@ -212,30 +443,82 @@ void scheduler_yield(void) {
         process_t* next_process = scheduler_schedule();
         
         if (next_process && next_process != old_process) {
-            // Update TSS kernel stack for the new process
-            uint32_t kernel_stack = (uint32_t)next_process->kernel_stack + 4096;
-            tss_set_kernel_stack(kernel_stack);
-            
-            // Update current process pointer
-            current_process = next_process;
-            
-            // Increment context switch counters
-            old_process->context_switches++;
-            next_process->context_switches++;
-            
-            // Perform the actual context switch
-            context_switch(&old_process->registers, &next_process->registers);
+            scheduler_switch(old_process, next_process, SCHED_TRACE_YIELD);
         }
     }
 }
 
+// Block the current process until scheduler_wake() (interrupts disabled)
+static void scheduler_block(void) {
+    process_t* old_process = current_process;
+    old_process->state = PROCESS_STATE_BLOCKED;
+    
+    // The idle process runs when nothing else is ready
+    process_t* next_process = scheduler_schedule();
+    scheduler_switch(old_process, next_process, SCHED_TRACE_BLOCK);
+}
+
+void scheduler_wake(process_t* process) {
+    if (process && process->state == PROCESS_STATE_BLOCKED) {
+        scheduler_add_process(process);
+    }
+}
+
+static void scheduler_sleep_expired(timer_event_t* event) {
+    scheduler_wake((process_t*)event->data);
+}
+
+int scheduler_sleep(uint32_t ticks) {
+    // The idle process is the fallback when everything else sleeps
+    if (!scheduler_enabled || !current_process || current_process->pid == 0) {
+        return -1;
+    }
+    
+    uint32_t eflags = irq_save();
+    timer_event_init(&current_process->sleep_timer, scheduler_sleep_expired,
+                     current_process);
+    timer_event_add(&current_process->sleep_timer, ticks);
+    scheduler_block();
+    irq_restore(eflags);
+    return 0;
+}
+
+// Switch from the idle process (the boot context) to 'process' and run it
+// until the scheduler picks something else. When the idle process next
+// runs, this returns and the caller continues as the idle loop.
+void scheduler_run(process_t* process) {
+    uint32_t eflags = irq_save();
+    
+    process_t* idle = current_process;
+    idle->state = PROCESS_STATE_READY;
+    process->state = PROCESS_STATE_RUNNING;
+    process->quantum = quantum_ticks;
+    scheduler_switch(idle, process, SCHED_TRACE_YIELD);
+    
+    irq_restore(eflags);
+}
+
+// Halt until the next interrupt, using the time for background work when
+// no other process is waiting for the CPU
+void scheduler_idle(void) {
+    if (ready_queue_count == 0 &&
+        pmm_zero_pool_refill(PMM_ZERO_POOL_BATCH) > 0) {
+        return;  // Caller re-checks its condition before idling again
+    }
+    
+    __asm__ volatile("hlt");
+}
+
 // Print scheduler statistics
 void scheduler_print_stats(void) {
     printk("\n=== Scheduler Statistics ===\n");
     printk("Status: %s\n", scheduler_enabled ? "ENABLED" : "DISABLED");
-    printk("Algorithm: Round-Robin\n");
+    printk("Algorithm: %s (%d levels)\n",
+           scheduler_policy_name(sched_policy), SCHED_PRIORITY_LEVELS);
     printk("Time Quantum: %d ticks\n", quantum_ticks);
     printk("Ready Queue: %d processes\n", ready_queue_count);
+    printk("Address Space Switches: %u (CR3 reload skipped on %u)\n",
+           context_cr3_reloads, context_cr3_skips);
     
     if (current_process) {
         printk("Current Process: %s (PID %d)\n", 
@@ -243,17 +526,57 @@ void scheduler_print_stats(void) {
         printk("  Quantum Remaining: %d ticks\n", current_process->quantum);
         printk("  Total Runtime: %d ticks\n", current_process->time_running);
         printk("  Context Switches: %d\n", current_process->context_switches);
+        if (sched_policy == SCHED_POLICY_FAIR) {
+            printk("  Virtual Runtime: %u\n", (uint32_t)current_process->vruntime);
+        }
     }
     
-    // List ready queue
-    if (ready_queue_head) {
-        printk("\nReady Queue:\n");
-        process_t* p = ready_queue_head;
+    // List the fair queue in vruntime order
+    if (sched_policy == SCHED_POLICY_FAIR && rb_first(&fair_queue)) {
+        printk("\nReady Queue (by virtual runtime):\n");
         int pos = 1;
-        while (p) {
-            printk("  %d. %s (PID %d, priority %d)\n", 
-                   pos++, p->name, p->pid, p->priority);
-            p = p->next;
+        for (rb_node_t* node = rb_first(&fair_queue); node; node = rb_next(node)) {
+            process_t* p = rb_entry(node, process_t, run_node);
+            printk("  %d. %s (PID %d, priority %d, vruntime %u)\n",
+                   pos++, p->name, p->pid, p->priority, (uint32_t)p->vruntime);
         }
     }
+    
+    // List ready queues, highest priority first
+    if (ready_bitmap) {
+        printk("\nReady Queues (bitmap 0x%x):\n", ready_bitmap);
+        int pos = 1;
+        for (int level = SCHED_PRIORITY_LEVELS - 1; level >= 0; level--) {
+            for (process_t* p = run_queues[level].head; p; p = p->next) {
+                printk("  %d. %s (PID %d, priority %d)\n", 
+                       pos++, p->name, p->pid, p->priority);
+            }
+        }
+    }
+}
+
+// Print the most recent max_events switches, oldest first
+void scheduler_trace_dump(uint32_t max_events) {
+    static const char* reasons[] = { "quantum", "preempt", "yield", "block" };
+    
+    uint32_t head = trace_head;
+    uint32_t count = head < SCHED_TRACE_SIZE ? head : SCHED_TRACE_SIZE;
+    if (max_events && count > max_events) {
+        count = max_events;
+    }
+    
+    printk("\n=== Context Switch Trace ===\n");
+    printk("%u switches recorded, showing the last %u\n", head, count);
+    
+    for (uint32_t n = head - count; n != head; n++) {
+        // Copy out first: a switch may overwrite the slot meanwhile
+        sched_trace_event_t event = trace_ring[n & (SCHED_TRACE_SIZE - 1)];
+        printk("  #%u tick %u: PID %u -> PID %u (%s)\n",
+               n, event.tick, event.old_pid, event.new_pid,
+               event.reason <= SCHED_TRACE_BLOCK ? reasons[event.reason] : "?");
+    }
+}
+
+void scheduler_trace_clear(void) {
+    trace_head = 0;
 }
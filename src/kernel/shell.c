@@ -3,6 +3,9 @@
 #include <keyboard.h>
 #include <printk.h>
 #include <memory.h>
+#include <pmm.h>
+#include <kmem_cache.h>
+#include <arena.h>
 #include <timer.h>
 #include <paging.h>
 #include <process.h>
@@ -13,6 +16,9 @@
 #define MAX_COMMAND_LENGTH 256
 #define MAX_ARGS 16
 
+// Scratch memory for the command being run; reset after every command
+static arena_t* shell_arena = NULL;
+
 // Forward declarations
 void cmd_usermode(const char* args);
 
@@ -50,6 +56,8 @@ static int strlen(const char* str) {
 }
 
 void shell_init(void) {
+    shell_arena = arena_create();
+    
     printk("\n");
     console_set_color(vga_entry_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK));
 
@@ -82,6 +90,7 @@ void shell_run(void) {
         // Process the command
         if (command_buffer[0] != '\0') {
             shell_process_command(command_buffer);
+            arena_reset(shell_arena);
         }
     }
 }
@@ -109,6 +118,8 @@ void shell_process_command(const char* command) {
         cmd_clear();
     } else if (strncmp(command, "meminfo", cmd_len) == 0 && cmd_len == 7) {
         cmd_meminfo();
+    } else if (strncmp(command, "heap", cmd_len) == 0 && cmd_len == 4) {
+        cmd_heap(args);
     } else if (strncmp(command, "sysinfo", cmd_len) == 0 && cmd_len == 7) {
         cmd_sysinfo();
     } else if (strncmp(command, "uptime", cmd_len) == 0 && cmd_len == 6) {
@@ -144,10 +155,11 @@ void cmd_help(void) {
     printk("  clear    - Clear the screen\n");
     printk("  sysinfo  - Display system information\n");
     printk("  meminfo  - Display memory information\n");
+    printk("  heap     - Heap profiling (stats/frag/top/prof/dump)\n");
     printk("  uptime   - Show system uptime\n");
     printk("  echo     - Echo text to screen\n");
     printk("  test     - Run various tests\n");
-    printk("  paging   - Virtual memory control (enable/status/test)\n");
+    printk("  paging   - Virtual memory control (enable/status/stats/test)\n");
     printk("  ps       - Process management (list/info/current)\n");
     printk("  sched    - Scheduler control (start/stop/stats)\n");
     printk("  usermode - User mode (ring 3) control\n");
@@ -164,6 +176,8 @@ void cmd_clear(void) {
 
 void cmd_meminfo(void) {
     memory_print_stats();
+    kmem_cache_print_stats();
+    pmm_print_stats();
     
     printk("\nMemory Test - Allocating and freeing blocks:\n");
     void* ptr1 = kmalloc(1024);
@@ -185,6 +199,34 @@ void cmd_meminfo(void) {
     printk("  Freed remaining blocks\n");
 }
 
+void cmd_heap(const char* args) {
+    if (!args || strcmp(args, "stats") == 0) {
+        memory_print_stats();
+    } else if (strcmp(args, "frag") == 0) {
+        memory_print_fragmentation();
+    } else if (strcmp(args, "top") == 0) {
+        memory_print_profile();
+    } else if (strcmp(args, "prof on") == 0) {
+        memory_profile_enable(1);
+        if (memory_profile_enabled()) {
+            printk("Allocation profiling enabled.\n");
+        }
+    } else if (strcmp(args, "prof off") == 0) {
+        memory_profile_enable(0);
+        printk("Allocation profiling disabled.\n");
+    } else if (strcmp(args, "dump") == 0) {
+        memory_dump_heap();
+    } else {
+        printk("Heap commands:\n");
+        printk("  heap stats     - Show heap statistics\n");
+        printk("  heap frag      - Show fragmentation and free block sizes\n");
+        printk("  heap top       - Show top allocation sites by live bytes\n");
+        printk("  heap prof on   - Start recording allocation sites\n");
+        printk("  heap prof off  - Stop recording allocation sites\n");
+        printk("  heap dump      - List every heap block (slow)\n");
+    }
+}
+
 void cmd_sysinfo(void) {
     printk("System Information:\n");
     printk("  OS:          Aether OS v0.1.0\n");
@@ -205,6 +247,8 @@ void cmd_uptime(void) {
     
     printk("System uptime: %u:%02u:%02u (%u seconds, %u ticks)\n",
            hours, minutes, seconds, uptime_sec, timer_get_ticks());
+    printk("Timer interrupts: %u, pending timer events: %u\n",
+           timer_get_interrupts(), timer_get_pending_events());
 }
 
 void cmd_echo(const char* args) {
@@ -221,6 +265,7 @@ void cmd_test(const char* args) {
         printk("  test malloc  - Memory allocation test\n");
         printk("  test timer   - Timer functionality test\n");
         printk("  test keys    - Keyboard modifier test\n");
+        printk("  test arena   - Command arena allocation test\n");
         return;
     }
     
@@ -253,25 +298,35 @@ void cmd_test(const char* args) {
         printk("Current modifiers: 0x%02x\n", keyboard_get_modifiers());
         printk("(Press any key to continue)\n");
         keyboard_getchar(); // Wait for keypress
+    } else if (strcmp(args, "arena") == 0) {
+        printk("Arena allocation test (freed when the command returns):\n");
+        for (int i = 0; i < 10; i++) {
+            void* ptr = arena_alloc(shell_arena, (i + 1) * 100);
+            printk("  arena_alloc(%d bytes) = %p\n", (i + 1) * 100, ptr);
+        }
+        
+        // Larger than a chunk: continues in a multi-frame chunk
+        void* big = arena_alloc(shell_arena, 3 * PAGE_SIZE);
+        printk("  arena_alloc(%d bytes) = %p\n", 3 * PAGE_SIZE, big);
+        arena_print_stats(shell_arena);
     } else {
         printk("Unknown test: %s\n", args);
     }
 }
 
 void cmd_paging(const char* args) {
-    static int paging_enabled = 0;
-    
     if (!args) {
         printk("Paging commands:\n");
         printk("  paging status  - Show paging status\n");
         printk("  paging enable  - Enable virtual memory\n");
         printk("  paging test    - Test page fault handler\n");
+        printk("  paging stats   - Show walk, fault and TLB counters\n");
         return;
     }
     
     if (strcmp(args, "status") == 0) {
         printk("Virtual Memory Status:\n");
-        if (paging_enabled) {
+        if (paging_is_enabled()) {
             printk("  State: ENABLED (virtual addressing active)\n");
             printk("  Page Directory: %p\n", paging_get_current_directory());
             printk("  Translation: Virtual -> Physical via MMU\n");
@@ -281,16 +336,18 @@ void cmd_paging(const char* args) {
                    paging_get_current_directory());
             printk("  Translation: Direct (no paging)\n");
         }
+        printk("  Kernel mapping: %s pages at 0x%x\n",
+               paging_has_large_pages() ? "4MB (PSE)" : "4KB", KERNEL_VIRTUAL_BASE);
         
         // Test address translation
-        uint32_t test_virt = 0x00100000;
+        uint32_t test_virt = KERNEL_VIRTUAL_BASE + KERNEL_START;
         uint32_t test_phys = paging_get_physical_address(
             paging_get_current_directory(), test_virt);
         printk("\n  Example: Virtual 0x%08X -> Physical 0x%08X\n", 
                test_virt, test_phys);
         
     } else if (strcmp(args, "enable") == 0) {
-        if (paging_enabled) {
+        if (paging_is_enabled()) {
             printk("Paging is already enabled!\n");
             return;
         }
@@ -320,7 +377,6 @@ void cmd_paging(const char* args) {
         
         // THE BIG MOMENT!
         paging_enable();
-        paging_enabled = 1;
         
         printk("\n");
         console_set_color(vga_entry_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK));
@@ -329,8 +385,11 @@ void cmd_paging(const char* args) {
         printk("\nAll memory accesses now go through the MMU.\n");
         printk("The kernel is running in virtual address space.\n");
         
+    } else if (strcmp(args, "stats") == 0) {
+        paging_print_stats();
+        
     } else if (strcmp(args, "test") == 0) {
-        if (!paging_enabled) {
+        if (!paging_is_enabled()) {
             printk_warn("Paging must be enabled first!");
             printk("Run 'paging enable' first.\n");
             return;
@@ -489,6 +548,28 @@ void cmd_sched(const char* args) {
             scheduler_yield();
             printk("Back from yield.\n");
         }
+    } else if (strncmp(args, "policy", 6) == 0 &&
+               (args[6] == ' ' || args[6] == '\0')) {
+        const char* name = args + 6;
+        while (*name == ' ') name++;
+        
+        if (*name == '\0') {
+            printk("Scheduling policy: %s\n",
+                   scheduler_policy_name(scheduler_get_policy()));
+        } else if (strcmp(name, "priority") == 0) {
+            scheduler_set_policy(SCHED_POLICY_PRIORITY);
+        } else if (strcmp(name, "fair") == 0) {
+            scheduler_set_policy(SCHED_POLICY_FAIR);
+        } else {
+            printk("Usage: sched policy [priority|fair]\n");
+        }
+    } else if (strcmp(args, "trace") == 0) {
+        scheduler_trace_dump(32);
+    } else if (strcmp(args, "trace all") == 0) {
+        scheduler_trace_dump(0);
+    } else if (strcmp(args, "trace clear") == 0) {
+        scheduler_trace_clear();
+        printk("Context switch trace cleared.\n");
     } else if (strcmp(args, "test") == 0) {
         // Simple test: just show we can track multiple processes
         printk("Process tracking test:\n");
@@ -503,6 +584,8 @@ void cmd_sched(const char* args) {
         printk("  sched start     - Enable scheduler & context switching\n");
         printk("  sched stop      - Disable scheduler\n");
         printk("  sched yield     - Yield to next ready process\n");
+        printk("  sched policy [priority|fair] - Show or set the scheduling policy\n");
+        printk("  sched trace [all|clear] - Show recent context switches\n");
         printk("  sched test      - Show process tracking capabilities\n");
     }
 }
@@ -3,10 +3,11 @@
 #include <process.h>
 #include <scheduler.h>
 #include <printk.h>
+#include <timer.h>
 #include <idt.h>
 
 // System call handler (called from assembly wrapper)
-void syscall_handler(registers_t* regs) {
+void syscall_handler(syscall_frame_t* regs) {
     uint32_t syscall_num = regs->eax;
     uint32_t arg1 = regs->ebx;
     uint32_t arg2 = regs->ecx;
@@ -35,6 +36,14 @@ void syscall_handler(registers_t* regs) {
             result = sys_yield();
             break;
             
+        case SYSCALL_FORK:
+            result = sys_fork(regs);
+            break;
+            
+        case SYSCALL_SLEEP:
+            result = sys_sleep(arg1);
+            break;
+            
         default:
             printk_warn("Unknown syscall: %d", syscall_num);
             result = -1;
@@ -100,6 +109,52 @@ int sys_yield(void) {
     return 0;
 }
 
+// Fork the current process. The child resumes after the same int 0x80
+// with EAX = 0; the parent gets the child's PID.
+int sys_fork(const syscall_frame_t* regs) {
+    process_t* child = process_fork(current_process);
+    if (!child) {
+        return -1;
+    }
+    
+    // iret frame on the child's kernel stack, as process_setup_user_mode
+    // builds it
+    uint32_t* kstack = (uint32_t*)(child->kernel_stack + KERNEL_STACK_SIZE);
+    *(--kstack) = regs->ss;
+    *(--kstack) = regs->useresp;
+    *(--kstack) = regs->eflags;
+    *(--kstack) = regs->cs;
+    *(--kstack) = regs->eip;
+    
+    child->registers.esp = (uint32_t)kstack;
+    child->registers.eip = regs->eip;
+    child->registers.eax = 0;
+    child->registers.ebx = regs->ebx;
+    child->registers.ecx = regs->ecx;
+    child->registers.edx = regs->edx;
+    child->registers.esi = regs->esi;
+    child->registers.edi = regs->edi;
+    child->registers.ebp = regs->ebp;
+    child->registers.eflags = regs->eflags;
+    
+    // User segments mark the context for an iret return to ring 3
+    child->registers.ds = 0x23;
+    child->registers.es = 0x23;
+    child->registers.fs = 0x23;
+    child->registers.gs = 0x23;
+    child->registers.ss = 0x23;
+    
+    scheduler_add_process(child);
+    return child->pid;
+}
+
+// Block the current process for at least 'milliseconds'. Fails (-1) when
+// the scheduler cannot run anything else meanwhile: halting here instead
+// would hang, as the interrupt gate entered with interrupts disabled.
+int sys_sleep(uint32_t milliseconds) {
+    return scheduler_sleep(timer_ms_to_ticks(milliseconds));
+}
+
 // Initialize system call interface
 void syscall_init(void) {
     printk_info("Initializing system call interface");
@@ -116,5 +171,7 @@ void syscall_init(void) {
     printk("    2 - write(fd, buf, len)\n");
     printk("    3 - read(fd, buf, len)\n");
     printk("    4 - yield()\n");
+    printk("    5 - fork()\n");
+    printk("    6 - sleep(ms)\n");
     printk("  [OK] System calls ready\n");
 }
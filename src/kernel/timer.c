@@ -1,7 +1,19 @@
 // timer.c - Programmable Interval Timer (PIT) driver for system ticks
-// Provides regular timer interrupts for scheduling and timekeeping
+// Provides regular timer interrupts for scheduling and timekeeping.
+// Dynamic ticks: while nothing is waiting for the CPU, the PIT is switched
+// to one-shot mode for several ticks at once (up to the next timer event),
+// and the skipped ticks are accounted when it fires.
+//
+// Timer events (sleeps and kernel timeouts) live in a hierarchical timing
+// wheel: events due within 256 ticks sit in the slot of their tick, later
+// ones in coarser levels of 64 slots each, and a coarse slot is spread
+// over the finer levels ("cascaded") when the wheel reaches it. Adding,
+// cancelling and expiring an event are O(1) amortized, however many are
+// pending.
 
 #include <stdint.h>
+#include <stddef.h>
+#include <timer.h>
 #include <printk.h>
 #include <scheduler.h>
 
@@ -27,10 +39,36 @@
 #define PIT_MODE3       (3 << 1)   // Mode 3: Square wave generator
 #define PIT_BINARY      (0 << 0)   // Binary mode
 #define PIT_BCD         (1 << 0)   // BCD mode
+#define PIT_LATCH       (0 << 4)   // Latch the count for reading
+
+// Largest PIT count. One-shots stay a tick's worth of counts below it, so
+// a count read just after the terminal count (when the counter wraps to
+// 0xFFFF) is recognisably larger than the one programmed.
+#define PIT_COUNT_MAX   0xFFFF
 
 // Global tick counter (32-bit to avoid runtime dependencies)
 static volatile uint32_t system_ticks = 0;
 static uint32_t timer_frequency_hz = 0;
+static uint32_t timer_divisor = 0;          // PIT counts per tick
+
+// Armed one-shot (oneshot_ticks == 0: periodic mode)
+static uint32_t oneshot_ticks = 0;          // Ticks accounted when it fires
+static uint32_t oneshot_count = 0;          // PIT count it was started with
+static uint32_t oneshot_max_ticks = 0;      // Longest one-shot, in ticks
+
+static uint32_t timer_interrupts = 0;
+
+// Timing wheel
+#define WHEEL_NEAR_BITS     8
+#define WHEEL_NEAR_SIZE     (1 << WHEEL_NEAR_BITS)
+#define WHEEL_FAR_BITS      6
+#define WHEEL_FAR_SIZE      (1 << WHEEL_FAR_BITS)
+#define WHEEL_FAR_LEVELS    4       // 8 + 4 * 6 bits cover the 32-bit tick
+
+static timer_event_t* wheel_near[WHEEL_NEAR_SIZE];
+static timer_event_t* wheel_far[WHEEL_FAR_LEVELS][WHEEL_FAR_SIZE];
+static uint32_t wheel_ticks = 0;            // Next tick to expire events for
+static uint32_t wheel_pending = 0;
 
 // External functions from PIC
 extern void pic_enable_irq(uint8_t irq);
@@ -47,6 +85,138 @@ static inline uint8_t inb(uint16_t port) {
     return ret;
 }
 
+static inline uint32_t irq_save(void) {
+    uint32_t eflags;
+    __asm__ volatile("pushf; pop %0; cli" : "=r"(eflags) : : "memory");
+    return eflags;
+}
+
+static inline void irq_restore(uint32_t eflags) {
+    if (eflags & 0x200) {
+        __asm__ volatile("sti" : : : "memory");
+    }
+}
+
+// Load channel 0 with a mode and count (0 means 65536)
+static void timer_program(uint8_t mode, uint32_t count) {
+    outb(PIT_COMMAND, PIT_SELECT_CH0 | PIT_ACCESS_BOTH | mode | PIT_BINARY);
+    outb(PIT_CHANNEL0, (uint8_t)(count & 0xFF));
+    outb(PIT_CHANNEL0, (uint8_t)((count >> 8) & 0xFF));
+}
+
+static uint32_t timer_read_count(void) {
+    outb(PIT_COMMAND, PIT_SELECT_CH0 | PIT_LATCH);
+    uint32_t low = inb(PIT_CHANNEL0);
+    uint32_t high = inb(PIT_CHANNEL0);
+    return (high << 8) | low;
+}
+
+// Link an event into the wheel slot for its expiry (interrupts disabled)
+static void wheel_insert(timer_event_t* event) {
+    uint32_t expires = event->expires;
+    uint32_t delta = expires - wheel_ticks;
+    timer_event_t** slot;
+    
+    if ((int32_t)delta < 0) {
+        // Already due: expire on the next tick
+        slot = &wheel_near[wheel_ticks & (WHEEL_NEAR_SIZE - 1)];
+    } else if (delta < WHEEL_NEAR_SIZE) {
+        slot = &wheel_near[expires & (WHEEL_NEAR_SIZE - 1)];
+    } else {
+        uint32_t level = 0;
+        uint32_t shift = WHEEL_NEAR_BITS;
+        while (level < WHEEL_FAR_LEVELS - 1 &&
+               delta >= (1u << (shift + WHEEL_FAR_BITS))) {
+            level++;
+            shift += WHEEL_FAR_BITS;
+        }
+        slot = &wheel_far[level][(expires >> shift) & (WHEEL_FAR_SIZE - 1)];
+    }
+    
+    event->next = *slot;
+    if (event->next) {
+        event->next->pprev = &event->next;
+    }
+    event->pprev = slot;
+    *slot = event;
+}
+
+// Respread the events of one far slot over the finer levels; returns the
+// slot index so the caller knows whether the next level wrapped as well
+static uint32_t wheel_cascade(uint32_t level) {
+    uint32_t shift = WHEEL_NEAR_BITS + level * WHEEL_FAR_BITS;
+    uint32_t index = (wheel_ticks >> shift) & (WHEEL_FAR_SIZE - 1);
+    
+    timer_event_t* event = wheel_far[level][index];
+    wheel_far[level][index] = NULL;
+    while (event) {
+        timer_event_t* next = event->next;
+        wheel_insert(event);
+        event = next;
+    }
+    return index;
+}
+
+// Run the events of every tick up to system_ticks (interrupts disabled)
+static void wheel_expire(void) {
+    while ((int32_t)(system_ticks - wheel_ticks) >= 0) {
+        uint32_t index = wheel_ticks & (WHEEL_NEAR_SIZE - 1);
+        if (index == 0) {
+            for (uint32_t level = 0; level < WHEEL_FAR_LEVELS; level++) {
+                if (wheel_cascade(level) != 0) {
+                    break;
+                }
+            }
+        }
+        
+        // Detach the slot first; callbacks may add events, which now land
+        // in later slots
+        timer_event_t* event = wheel_near[index];
+        wheel_near[index] = NULL;
+        wheel_ticks++;
+        
+        while (event) {
+            timer_event_t* next = event->next;
+            event->next = NULL;
+            event->pprev = NULL;
+            wheel_pending--;
+            event->callback(event);
+            event = next;
+        }
+    }
+}
+
+// Ticks from now until the wheel has something to do, at most 'limit'.
+// A near-level wrap counts as work: far events may cascade into it.
+static uint32_t wheel_idle_ticks(uint32_t limit) {
+    uint32_t tick = wheel_ticks;
+    while (tick - system_ticks < limit) {
+        uint32_t index = tick & (WHEEL_NEAR_SIZE - 1);
+        if (wheel_near[index] || index == 0) {
+            break;
+        }
+        tick++;
+    }
+    return tick - system_ticks;
+}
+
+// Replace periodic ticks with one interrupt several ticks away if nothing
+// needs the CPU before then (interrupts disabled)
+static void timer_oneshot_arm(void) {
+    if (oneshot_max_ticks < 2 || scheduler_needs_tick()) {
+        return;
+    }
+    
+    uint32_t ticks = wheel_idle_ticks(oneshot_max_ticks);
+    if (ticks < 2) {
+        return;
+    }
+    
+    oneshot_ticks = ticks;
+    oneshot_count = ticks * timer_divisor;
+    timer_program(PIT_MODE0, oneshot_count);
+}
+
 void timer_init(uint32_t frequency_hz) {
     printk_info("Initializing Programmable Interval Timer (PIT)");
     
@@ -59,18 +229,15 @@ void timer_init(uint32_t frequency_hz) {
     
     // Calculate actual frequency we'll get
     timer_frequency_hz = PIT_FREQUENCY / divisor;
+    timer_divisor = divisor;
+    oneshot_max_ticks = (PIT_COUNT_MAX - divisor) / divisor;
     
     printk("  Requested: %u Hz, Divisor: %u, Actual: %u Hz\n", 
            frequency_hz, divisor, timer_frequency_hz);
     
     // Configure PIT Channel 0 for periodic interrupts
     // Mode 2 (rate generator) with binary counting, access low/high byte
-    uint8_t command = PIT_SELECT_CH0 | PIT_ACCESS_BOTH | PIT_MODE2 | PIT_BINARY;
-    outb(PIT_COMMAND, command);
-    
-    // Send divisor (low byte first, then high byte)
-    outb(PIT_CHANNEL0, (uint8_t)(divisor & 0xFF));
-    outb(PIT_CHANNEL0, (uint8_t)((divisor >> 8) & 0xFF));
+    timer_program(PIT_MODE2, divisor);
     
     // Enable IRQ 0 (timer interrupt)
     pic_enable_irq(0);
@@ -79,18 +246,35 @@ void timer_init(uint32_t frequency_hz) {
            timer_frequency_hz,
            1000 / timer_frequency_hz,
            (1000000 / timer_frequency_hz) % 1000);
+    if (oneshot_max_ticks >= 2) {
+        printk("  Dynamic ticks: up to %u ticks per interrupt when idle\n",
+               oneshot_max_ticks);
+    }
 }
 
 // Timer interrupt handler (called from IRQ 0 handler)
 void timer_handler(void) {
-    system_ticks++;
+    uint32_t elapsed = 1;
+    if (oneshot_ticks) {
+        // Back to periodic ticks until we know nothing needs them
+        elapsed = oneshot_ticks;
+        oneshot_ticks = 0;
+        timer_program(PIT_MODE2, timer_divisor);
+    }
+    system_ticks += elapsed;
+    timer_interrupts++;
+    
+    // Wake sleepers and run expired timeouts
+    wheel_expire();
     
     // Call scheduler tick for process scheduling
-    scheduler_tick();
+    scheduler_tick(elapsed);
     
     // Send End-of-Interrupt to PIC
     pic_send_eoi(0);
     
+    timer_oneshot_arm();
+    
     // NOTE: Automatic tick printing disabled for cleaner shell
     // Use 'uptime' command to check system uptime
     // Uncomment below to re-enable automatic tick messages:
@@ -102,7 +286,30 @@ void timer_handler(void) {
     */
 }
 
-// Get current tick count
+// Make the armed one-shot (if any) fire at the next tick boundary, so that
+// periodic ticks resume within one tick
+void timer_restart_tick(void) {
+    uint32_t eflags = irq_save();
+    
+    if (oneshot_ticks && oneshot_count > timer_divisor) {
+        uint32_t remaining = timer_read_count();
+        
+        // 0 or larger than programmed: it already fired (IRQ pending)
+        if (remaining != 0 && remaining <= oneshot_count) {
+            uint32_t counted = oneshot_count - remaining;
+            uint32_t elapsed = counted / timer_divisor;
+            uint32_t rest = (elapsed + 1) * timer_divisor - counted;
+            
+            oneshot_ticks = elapsed + 1;
+            oneshot_count = rest;
+            timer_program(PIT_MODE0, rest);
+        }
+    }
+    
+    irq_restore(eflags);
+}
+
+// Get current tick count (lags by up to the armed one-shot while idle)
 uint32_t timer_get_ticks(void) {
     return system_ticks;
 }
@@ -117,17 +324,90 @@ uint32_t timer_get_frequency(void) {
     return timer_frequency_hz;
 }
 
-// Sleep for specified number of ticks
+// Number of timer interrupts taken (fewer than ticks with dynamic ticks)
+uint32_t timer_get_interrupts(void) {
+    return timer_interrupts;
+}
+
+void timer_event_init(timer_event_t* event, void (*callback)(timer_event_t* event),
+                      void* data) {
+    event->next = NULL;
+    event->pprev = NULL;
+    event->expires = 0;
+    event->callback = callback;
+    event->data = data;
+}
+
+void timer_event_add(timer_event_t* event, uint32_t ticks) {
+    uint32_t eflags = irq_save();
+    
+    if (event->pprev) {
+        timer_event_cancel(event);
+    }
+    event->expires = system_ticks + ticks;
+    wheel_insert(event);
+    wheel_pending++;
+    
+    // Cut a one-shot that would overrun the event short
+    if (oneshot_ticks && oneshot_ticks > ticks) {
+        timer_restart_tick();
+    }
+    
+    irq_restore(eflags);
+}
+
+int timer_event_cancel(timer_event_t* event) {
+    uint32_t eflags = irq_save();
+    
+    int pending = event->pprev != NULL;
+    if (pending) {
+        *event->pprev = event->next;
+        if (event->next) {
+            event->next->pprev = event->pprev;
+        }
+        event->next = NULL;
+        event->pprev = NULL;
+        wheel_pending--;
+    }
+    
+    irq_restore(eflags);
+    return pending;
+}
+
+uint32_t timer_get_pending_events(void) {
+    return wheel_pending;
+}
+
+static void timer_sleep_expired(timer_event_t* event) {
+    *(volatile int*)event->data = 1;
+}
+
+// Sleep for specified number of ticks. Processes block in the scheduler;
+// the idle process (and anything running before the scheduler is enabled)
+// halts until the wakeup event fires instead.
 void timer_sleep_ticks(uint32_t ticks) {
-    uint32_t target = system_ticks + ticks;
-    while (system_ticks < target) {
-        __asm__ volatile("hlt");  // Halt until next interrupt
+    if (scheduler_sleep(ticks) == 0) {
+        return;
+    }
+    
+    volatile int expired = 0;
+    timer_event_t event;
+    timer_event_init(&event, timer_sleep_expired, (void*)&expired);
+    timer_event_add(&event, ticks);
+    while (!expired) {
+        scheduler_idle();  // Halt until next interrupt
     }
 }
 
+// Convert milliseconds to ticks, rounding down but to at least one tick
+uint32_t timer_ms_to_ticks(uint32_t milliseconds) {
+    uint32_t ticks = (milliseconds / 1000) * timer_frequency_hz +
+                     (milliseconds % 1000) * timer_frequency_hz / 1000;
+    if (ticks == 0) ticks = 1;  // Sleep at least one tick
+    return ticks;
+}
+
 // Sleep for specified milliseconds (approximate)
 void timer_sleep_ms(uint32_t milliseconds) {
-    uint32_t ticks = (milliseconds * timer_frequency_hz) / 1000;
-    if (ticks == 0) ticks = 1;  // Sleep at least one tick
-    timer_sleep_ticks(ticks);
+    timer_sleep_ticks(timer_ms_to_ticks(milliseconds));
 }
\ No newline at end of file
@@ -7,6 +7,16 @@
 // Global TSS
 tss_entry_t kernel_tss;
 
+// Double fault task
+// A double fault is entered through a task gate, so the handler runs on its
+// own stack. A fault that cannot push onto the current stack (a kernel stack
+// overflowing into its guard page) then still reaches a handler instead of
+// escalating to a triple fault and a reset.
+static tss_entry_t double_fault_tss;
+static uint8_t double_fault_stack[4096] __attribute__((aligned(16)));
+
+extern void double_fault_task(void);
+
 // External GDT functions
 extern void gdt_set_gate(int num, uint32_t base, uint32_t limit, uint8_t access, uint8_t gran);
 
@@ -42,6 +52,25 @@ void tss_init(uint32_t kernel_stack) {
     // Granularity: 0x00 = byte granularity
     gdt_set_gate(5, base, limit, 0xE9, 0x00);
     
+    // Double fault TSS descriptor (entry 6): Present, Ring 0, 32-bit TSS
+    memset(&double_fault_tss, 0, sizeof(tss_entry_t));
+    double_fault_tss.eip = (uint32_t)double_fault_task;
+    double_fault_tss.esp = (uint32_t)&double_fault_stack[sizeof(double_fault_stack)];
+    double_fault_tss.eflags = 0x2;     // Interrupts stay disabled
+    double_fault_tss.cs = 0x08;
+    double_fault_tss.ss = 0x10;
+    double_fault_tss.ds = 0x10;
+    double_fault_tss.es = 0x10;
+    double_fault_tss.fs = 0x10;
+    double_fault_tss.gs = 0x10;
+    double_fault_tss.iomap_base = sizeof(tss_entry_t);
+    // Paging is on from the first instruction: start in the boot page
+    // directory until paging_init() installs the kernel's own
+    uint32_t cr3;
+    __asm__ volatile("mov %%cr3, %0" : "=r"(cr3));
+    double_fault_tss.cr3 = cr3;
+    gdt_set_gate(6, (uint32_t)&double_fault_tss, limit, 0x89, 0x00);
+    
     printk("  TSS at 0x%08X, size %d bytes\n", base, limit + 1);
     printk("  Kernel stack: SS=0x%04X, ESP=0x%08X\n", kernel_tss.ss0, kernel_tss.esp0);
     
@@ -56,6 +85,11 @@ void tss_set_kernel_stack(uint32_t stack) {
     kernel_tss.esp0 = stack;
 }
 
+// Address space the double fault task switches to
+void tss_set_double_fault_cr3(uint32_t cr3) {
+    double_fault_tss.cr3 = cr3;
+}
+
 // Assembly function to load TSS
 extern void tss_flush_asm(void);
 
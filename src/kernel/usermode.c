@@ -3,6 +3,9 @@
 #include <process.h>
 #include <printk.h>
 #include <memory.h>
+#include <pmm.h>
+#include <paging.h>
+#include <vma.h>
 
 // User mode test code (position-independent assembly)
 extern void user_mode_test_1_asm(void);
@@ -20,16 +23,16 @@ uint32_t get_current_privilege_level(void) {
     return cs & 0x3;  // CPL is in bits 0-1
 }
 
-// Copy kernel function to user-accessible memory
-static void* copy_to_user_memory(void* func_start, void* func_end, uint32_t user_base) {
-    uint8_t* src = (uint8_t*)func_start;
-    uint8_t* dst = (uint8_t*)user_base;
+// Copy kernel function into the process's code area
+static void* copy_to_user_memory(process_t* process, void* func_start, void* func_end,
+                                 uint32_t user_base) {
     uint32_t size = (uint32_t)func_end - (uint32_t)func_start;
     
-    printk("    Copying %d bytes from 0x%x to 0x%x\n", size, (uint32_t)src, (uint32_t)dst);
+    printk("    Copying %d bytes from 0x%x to 0x%x\n", size, (uint32_t)func_start, user_base);
     
-    for (uint32_t i = 0; i < size; i++) {
-        dst[i] = src[i];
+    if (!vma_reserve(process, user_base, size, VMA_READ | VMA_EXEC) ||
+        vma_copy_in(process, user_base, func_start, size) != 0) {
+        return NULL;
     }
     
     return (void*)user_base;
@@ -42,13 +45,29 @@ void process_setup_user_mode(process_t* process, void (*entry_point)(void)) {
         return;
     }
     
-    // Allocate user memory region (in user space, below kernel)
-    // User space: 0x00000000 - 0xBFFFFFFF
-    // Each process gets 1MB starting at 0x00400000 (4MB mark)
-    uint32_t user_base = 0x00400000 + (process->pid * 0x100000);  // 1MB per process
-    uint32_t user_code = user_base;                                // Code at base
-    uint32_t user_stack_base = user_base + 0x80000;               // Stack at 512KB offset
-    uint32_t user_stack_top = user_stack_base + 0x4000;           // 16KB user stack
+    if (process->vmas) {
+        printk_error("Process %d already has a user address space", process->pid);
+        return;
+    }
+    
+    // Give the process its own address space. The kernel part is shared;
+    // user memory is reserved as VMAs and backed by frames on first touch.
+    if (process->page_directory == paging_get_kernel_directory()) {
+        page_directory_t* dir = paging_create_directory();
+        if (!dir) {
+            printk_error("Out of memory for user address space");
+            return;
+        }
+        process->page_directory = dir;
+        process->registers.cr3 = virt_to_phys(dir);
+    }
+    
+    uint32_t user_code = USER_CODE_BASE;
+    uint32_t user_stack_base = USER_STACK_TOP - USER_STACK_RESERVE;
+    uint32_t user_stack_top = USER_STACK_TOP;
+    if (!vma_reserve(process, user_stack_base, USER_STACK_RESERVE, VMA_READ | VMA_WRITE)) {
+        return;
+    }
     
     // Determine which assembly function to copy based on entry_point
     void* func_start;
@@ -66,10 +85,14 @@ void process_setup_user_mode(process_t* process, void (*entry_point)(void)) {
     }
     
     // Copy the function code to user-accessible memory
-    void* user_entry = copy_to_user_memory(func_start, func_end, user_code);
+    void* user_entry = copy_to_user_memory(process, func_start, func_end, user_code);
+    if (!user_entry) {
+        printk_error("Failed to set up user code for process %d", process->pid);
+        return;
+    }
     
     // Set up kernel stack for iret to user mode
-    uint32_t* kstack = (uint32_t*)(process->kernel_stack + 4096);
+    uint32_t* kstack = (uint32_t*)(process->kernel_stack + KERNEL_STACK_SIZE);
     
     // Build stack frame for iret instruction
     // iret expects (from top of stack): EIP, CS, EFLAGS, ESP, SS
@@ -108,7 +131,8 @@ void process_setup_user_mode(process_t* process, void (*entry_point)(void)) {
     printk("  Set up user mode for process %d (PID %d)\n", process->pid, process->pid);
     printk("    Entry point: 0x%x -> 0x%x (copied to user memory)\n", 
            (uint32_t)entry_point, (uint32_t)user_entry);
-    printk("    User stack: 0x%x - 0x%x\n", user_stack_base, user_stack_top);
+    printk("    User stack: 0x%x - 0x%x (populated on demand)\n",
+           user_stack_base, user_stack_top);
     printk("    Kernel stack: 0x%x\n", (uint32_t)process->kernel_stack);
 }
 
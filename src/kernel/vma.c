@@ -0,0 +1,240 @@
+// vma.c - Virtual memory areas and demand zero-fill paging
+#include <vma.h>
+#include <process.h>
+#include <paging.h>
+#include <pmm.h>
+#include <memory.h>
+#include <kmem_cache.h>
+#include <printk.h>
+#include <stdint.h>
+#include <stddef.h>
+
+static kmem_cache_t* vma_cache = NULL;
+
+// Pages mapped or copied by the fault handler since boot
+static uint32_t demand_faults = 0;
+static uint32_t cow_faults = 0;
+
+void vma_init(void) {
+    vma_cache = kmem_cache_create("vma", sizeof(vma_t), kmem_ctor_zero, 0);
+}
+
+vma_t* vma_reserve(process_t* process, uint32_t start, uint32_t size, uint32_t flags) {
+    if (!process || size == 0) {
+        return NULL;
+    }
+
+    uint32_t end = PAGE_ALIGN(start + size);
+    start &= ~(PAGE_SIZE - 1);
+    if (start < USER_SPACE_START || end > USER_SPACE_END || end <= start) {
+        printk_error("vma: range 0x%x - 0x%x is outside user space", start, end);
+        return NULL;
+    }
+
+    // Keep the list sorted by address, refusing overlaps
+    vma_t** link = &process->vmas;
+    while (*link && (*link)->end <= start) {
+        link = &(*link)->next;
+    }
+    if (*link && (*link)->start < end) {
+        printk_error("vma: range 0x%x - 0x%x overlaps an existing area", start, end);
+        return NULL;
+    }
+
+    vma_t* vma = (vma_t*)kmem_cache_alloc(vma_cache);
+    if (!vma) {
+        return NULL;
+    }
+    vma->start = start;
+    vma->end = end;
+    vma->flags = flags;
+    vma->next = *link;
+    *link = vma;
+    return vma;
+}
+
+vma_t* vma_find(process_t* process, uint32_t addr) {
+    if (!process) {
+        return NULL;
+    }
+
+    for (vma_t* vma = process->vmas; vma && vma->start <= addr; vma = vma->next) {
+        if (addr < vma->end) {
+            return vma;
+        }
+    }
+    return NULL;
+}
+
+// Back one page of a VMA with a zeroed frame. Returns the frame, 0 when
+// out of memory.
+static uint32_t vma_populate_page(process_t* process, vma_t* vma, uint32_t page) {
+    uint32_t frame = pmm_alloc_zeroed_frame();
+    if (!frame) {
+        return 0;
+    }
+    pmm_frame_ref(frame);
+
+    uint32_t flags = PAGE_USER;
+    if (vma->flags & VMA_WRITE) {
+        flags |= PAGE_WRITE;
+    }
+    paging_map_page(process->page_directory, page, frame, flags);
+    vma->resident_pages++;
+    return frame;
+}
+
+int vma_copy_in(process_t* process, uint32_t addr, const void* data, uint32_t size) {
+    const uint8_t* src = (const uint8_t*)data;
+
+    while (size > 0) {
+        vma_t* vma = vma_find(process, addr);
+        if (!vma) {
+            return -1;
+        }
+
+        uint32_t page = addr & ~(PAGE_SIZE - 1);
+        uint32_t frame = paging_get_physical_address(process->page_directory, page);
+        if (!frame) {
+            frame = vma_populate_page(process, vma, page);
+            if (!frame) {
+                return -1;
+            }
+        }
+
+        uint32_t offset = addr - page;
+        uint32_t chunk = PAGE_SIZE - offset;
+        if (chunk > size) {
+            chunk = size;
+        }
+        memcpy(phys_to_virt(frame + offset), src, chunk);
+
+        addr += chunk;
+        src += chunk;
+        size -= chunk;
+    }
+
+    return 0;
+}
+
+// Write to a page shared copy-on-write after fork
+static int vma_handle_cow(process_t* process, uint32_t page) {
+    page_table_entry_t* pte = paging_get_pte(process->page_directory, page);
+    if (!pte || !(*pte & PAGE_COW)) {
+        return 0;
+    }
+
+    uint32_t frame = paging_get_address(*pte);
+    uint32_t flags = (paging_get_flags(*pte) & ~PAGE_COW) | PAGE_WRITE;
+
+    // The last sharer simply takes the frame back
+    if (pmm_frame_refcount(frame) > 1) {
+        uint32_t copy = pmm_alloc_frame();
+        if (!copy) {
+            printk_error("Out of memory for copy-on-write at 0x%x (PID %d)",
+                         page, process->pid);
+            return 0;
+        }
+        memcpy(phys_to_virt(copy), phys_to_virt(frame), PAGE_SIZE);
+        pmm_frame_ref(copy);
+        pmm_frame_unref(frame);
+        frame = copy;
+    }
+
+    *pte = paging_create_pte(frame, flags);
+    paging_invalidate_page(process->page_directory, page);
+    cow_faults++;
+    return 1;
+}
+
+int vma_handle_fault(process_t* process, uint32_t addr, uint32_t error_code) {
+    if (error_code & PAGE_FAULT_RESERVED) {
+        return 0;
+    }
+
+    vma_t* vma = vma_find(process, addr);
+    if (!vma) {
+        return 0;
+    }
+    if ((error_code & PAGE_FAULT_WRITE) && !(vma->flags & VMA_WRITE)) {
+        return 0;
+    }
+
+    // A write to a present page can only be resolved by breaking sharing
+    if (error_code & PAGE_FAULT_PRESENT) {
+        if (!(error_code & PAGE_FAULT_WRITE)) {
+            return 0;
+        }
+        return vma_handle_cow(process, addr & ~(PAGE_SIZE - 1));
+    }
+
+    if (!vma_populate_page(process, vma, addr & ~(PAGE_SIZE - 1))) {
+        printk_error("Out of memory for demand paging at 0x%x (PID %d)",
+                     addr, process->pid);
+        return 0;
+    }
+
+    demand_faults++;
+    return 1;
+}
+
+int vma_clone(process_t* src, process_t* dst) {
+    vma_t** link = &dst->vmas;
+
+    for (vma_t* vma = src->vmas; vma; vma = vma->next) {
+        vma_t* copy = (vma_t*)kmem_cache_alloc(vma_cache);
+        if (!copy) {
+            return -1;
+        }
+        copy->start = vma->start;
+        copy->end = vma->end;
+        copy->flags = vma->flags;
+        copy->resident_pages = vma->resident_pages;
+        *link = copy;
+        link = &copy->next;
+    }
+
+    return 0;
+}
+
+void vma_release_all(process_t* process) {
+    if (!process) {
+        return;
+    }
+
+    vma_t* vma = process->vmas;
+    while (vma) {
+        // Only resident pages have frames to give back, and only once the
+        // process has an address space (a fork that failed may not)
+        if (vma->resident_pages && process->page_directory) {
+            paging_unmap_range(process->page_directory, vma->start,
+                               vma->end - vma->start, pmm_frame_unref);
+            vma->resident_pages = 0;
+        }
+
+        vma_t* next = vma->next;
+        memset(vma, 0, sizeof(vma_t));
+        kmem_cache_free(vma_cache, vma);
+        vma = next;
+    }
+    process->vmas = NULL;
+}
+
+void vma_print(process_t* process) {
+    if (!process || !process->vmas) {
+        return;
+    }
+
+    printk("    Memory areas:\n");
+    for (vma_t* vma = process->vmas; vma; vma = vma->next) {
+        printk("      0x%x - 0x%x %c%c%c  %u KB reserved, %u KB resident\n",
+               vma->start, vma->end,
+               (vma->flags & VMA_READ) ? 'r' : '-',
+               (vma->flags & VMA_WRITE) ? 'w' : '-',
+               (vma->flags & VMA_EXEC) ? 'x' : '-',
+               (vma->end - vma->start) / 1024,
+               vma->resident_pages * (PAGE_SIZE / 1024));
+    }
+    printk("    Demand-zero faults: %u, copy-on-write faults: %u (all processes)\n",
+           demand_faults, cow_faults);
+}